@@ -26,6 +26,7 @@ typedef struct _IO_FILE FILE;
 #endif
 #if defined(__USER__)
 #define BUFSIZ 512
+#define FOPEN_MAX 100 // streams open at once
 extern FILE *stdin;
 extern FILE *stdout;
 extern FILE *stderr;
@@ -0,0 +1,23 @@
+#pragma once
+#include <stdint.h>
+
+// File system statistics, as returned by fsstat().
+struct fsstat {
+	uint32_t nblocks; // blocks in the file system
+	uint32_t nfree; // ... that are free
+	uint32_t nextents; // runs of free blocks
+	uint32_t maxextent; // longest run of free blocks
+	uint64_t allocs; // blocks allocated since boot
+	uint64_t contiguous; // ... right after the file's previous block
+	uint64_t frees; // blocks freed since boot
+	uint64_t latency; // TSC cycles spent allocating
+	uint64_t maxlatency; // longest single allocation
+	uint64_t dc_hits; // path lookups answered by the name cache
+	uint64_t dc_neghits; // ... with "no such name"
+	uint64_t dc_misses; // ... that had to read the directory
+};
+
+#ifndef __KERNEL__
+int
+fsstat(struct fsstat *);
+#endif
@@ -0,0 +1,19 @@
+#pragma once
+
+// Whose priority getpriority() and setpriority() are about.
+// Only PRIO_PROCESS is supported.
+#define PRIO_PROCESS 0
+#define PRIO_PGRP 1
+#define PRIO_USER 2
+
+// Nice values run from NICE_MIN, the most CPU time,
+// to NICE_MAX, the least.
+#define NICE_MIN (-20)
+#define NICE_MAX 19
+
+#ifndef __KERNEL__
+int
+getpriority(int which, int who);
+int
+setpriority(int which, int who, int prio);
+#endif
@@ -19,6 +19,10 @@ struct tm {
 };
 time_t
 time(time_t *tloc);
+int
+nanosleep(const struct timespec *req, struct timespec *rem);
+int
+clock_gettime(clockid_t clock, struct timespec *tp);
 
 // clang-format off
 // this is a workaround for now.
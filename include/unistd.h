@@ -59,6 +59,8 @@ int
 setuid(int);
 int
 fsync(int fd);
+int
+nice(int inc);
 extern char *optarg;
 extern int optind, opterr, optopt;
 int
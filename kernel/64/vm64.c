@@ -96,6 +96,10 @@ seginit(void)
 
 	lidt((void *)idt, PGSIZE);
 
+	// Make kernel writes honour read-only user mappings,
+	// so that they fault on copy-on-write pages too.
+	lcr0(rcr0() | CR0_WP);
+
 	// create a page for cpu local storage
 	local = kalloc();
 	memset(local, 0, PGSIZE);
@@ -136,13 +140,19 @@ seginit(void)
 uintptr_t *
 setupkvm(void)
 {
-	uintptr_t *pml4 = (uintptr_t *)kalloc();
-	uintptr_t *pdpt = (uintptr_t *)kalloc();
-	uintptr_t *pgdir = (uintptr_t *)kalloc();
-
-	memset(pml4, 0, PGSIZE);
-	memset(pdpt, 0, PGSIZE);
-	memset(pgdir, 0, PGSIZE);
+	uintptr_t *pml4 = (uintptr_t *)kpage_alloc_zeroed();
+	uintptr_t *pdpt = (uintptr_t *)kpage_alloc_zeroed();
+	uintptr_t *pgdir = (uintptr_t *)kpage_alloc_zeroed();
+
+	if (pml4 == NULL || pdpt == NULL || pgdir == NULL) {
+		if (pml4)
+			kpage_free((char *)pml4);
+		if (pdpt)
+			kpage_free((char *)pdpt);
+		if (pgdir)
+			kpage_free((char *)pgdir);
+		return NULL;
+	}
 	/*
 	 * This code syncs with the setup code in entry64.S
 	 */
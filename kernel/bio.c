@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -22,109 +22,289 @@
 #include "buf.h"
 #include "ide.h"
 #include "macros.h"
+#include "ioctl.h"
+#include "kalloc.h"
+#include "proc.h"
+#include "drivers/mmu.h"
+#include <string.h>
 
-extern int ncpu;
-#define NBUCKET NCPU
+static void
+block_unref(struct buf *b);
 
-struct {
-	struct buf buf[NBUF];
+extern uint64_t available_memory;
+
+#define NBUCKET 251 // prime, so block numbers spread evenly
+#define BUFS_PER_PAGE (PGSIZE / sizeof(struct buf))
 
-	// Linked list of all buffers, through prev/next.
-	// Sorted by how recently the buffer was used.
-	// head.next is most recent, head.prev is least.
-	// Hash bucket
+struct {
+	// Buffers are found through a hash table on (dev, blockno).
+	// Each bucket is a circular list through prev/next with its
+	// own lock, which protects the list, the dev, blockno and
+	// refcnt of the buffers on it, and their bucket field.
 	struct buf bucket[NBUCKET];
 	struct spinlock bucket_lock[NBUCKET];
+
+	// Every buffer, for the clock hand. Buffer n is
+	// bufpages[n / BUFS_PER_PAGE][n % BUFS_PER_PAGE].
+	struct buf *bufpages[NBUF_MAX / BUFS_PER_PAGE + 1];
+	uint32_t hand;
+
+	struct bio_stats stats;
+
+	// Processes waiting for a buffer to become free
+	// sleep on &block_cache.nfreed under waitlock. Freeing
+	// a buffer only takes waitlock if nwaiting says someone
+	// may be asleep.
+	struct spinlock waitlock;
+	uint64_t nfreed;
+	uint32_t nwaiting;
 } block_cache;
 
-int
-hash(uint32_t blockno)
+static int
+hash(uint32_t dev, uint32_t blockno)
 {
-	return blockno % min(NBUCKET, ncpu);
+	return (blockno ^ (dev * 0x9e3779b1U)) % NBUCKET;
 }
 
+static struct buf *
+block_nth(uint32_t n)
+{
+	return &block_cache.bufpages[n / BUFS_PER_PAGE][n % BUFS_PER_PAGE];
+}
+
+static void
+bucket_acquire(int hi)
+{
+	// Racy, but good enough to see whether the buckets are contended.
+	if (__atomic_load_n(&block_cache.bucket_lock[hi].locked, __ATOMIC_RELAXED))
+		__sync_add_and_fetch(&block_cache.stats.contended, 1);
+	__sync_add_and_fetch(&block_cache.stats.acquires, 1);
+	acquire(&block_cache.bucket_lock[hi]);
+}
+
+// Insert b at the head of bucket hi, which must be held.
+static void
+bucket_insert(int hi, struct buf *b)
+{
+	b->next = block_cache.bucket[hi].next;
+	b->prev = &block_cache.bucket[hi];
+	block_cache.bucket[hi].next->prev = b;
+	block_cache.bucket[hi].next = b;
+	b->bucket = hi;
+}
+
+// Size the cache from the amount of memory and carve the
+// buffers out of page frames, two blocks to a page.
+// Must run after kinit2() so the pages can come from all of memory.
 void
 block_init(void)
 {
 	struct buf *b;
+	uint8_t *data = NULL;
+	uint32_t nbuf;
+	size_t ndata = 0;
 
-	for (int i = 0; i < min(NBUCKET, ncpu); i++) {
+	for (int i = 0; i < NBUCKET; i++) {
 		initlock(&block_cache.bucket_lock[i], "block_cache.bucket");
 		block_cache.bucket[i].next = &block_cache.bucket[i];
 		block_cache.bucket[i].prev = &block_cache.bucket[i];
 	}
+	initlock(&block_cache.waitlock, "block_cache.wait");
+
+	nbuf = available_memory / BUF_MEMSHARE / BSIZE;
+	nbuf = min(max(nbuf, NBUF), NBUF_MAX);
 
 	// Create hash table of buffers
-	for (b = block_cache.buf; b < block_cache.buf + NBUF; b++) {
-		int hi = hash(b->blockno);
-		b->next = block_cache.bucket[hi].next;
-		b->prev = &block_cache.bucket[hi];
+	for (uint32_t n = 0; n < nbuf; n++) {
+		if (n % BUFS_PER_PAGE == 0) {
+			if ((b = (struct buf *)kpage_alloc()) == NULL)
+				break;
+			memset(b, 0, PGSIZE);
+			block_cache.bufpages[n / BUFS_PER_PAGE] = b;
+		}
+		if (ndata == 0) {
+			if ((data = (uint8_t *)kpage_alloc()) == NULL)
+				break;
+			ndata = PGSIZE / BSIZE;
+		}
+		b = block_nth(n);
+		b->data = data;
+		data += BSIZE;
+		ndata--;
+		// A placeholder identity that nothing looks up.
+		b->dev = ~0U;
+		b->blockno = ~0U;
 		initsleeplock(&b->lock, "buffer");
-		block_cache.bucket[hi].next->prev = b;
-		block_cache.bucket[hi].next = b;
+		bucket_insert(hash(b->dev, b->blockno), b);
+		block_cache.stats.nbuf++;
 	}
+	if (block_cache.stats.nbuf < NBUF)
+		panic("block_init");
+}
+
+// Take b over for block blockno of dev.
+// Caller must hold the lock of the bucket b is in.
+static void
+block_recycle(struct buf *b, uint32_t dev, uint32_t blockno)
+{
+	if (b->flags & B_READAHEAD)
+		__sync_add_and_fetch(&block_cache.stats.ra_wasted, 1);
+	if (b->flags & B_VALID)
+		__sync_add_and_fetch(&block_cache.stats.evictions, 1);
+	b->dev = dev;
+	b->blockno = blockno;
+	b->flags = 0;
+	b->refcnt = 1;
+}
+
+// Pick an unused buffer with the clock algorithm, take it
+// out of its bucket and return it with a reference held.
+// Buffers used since the hand last passed get a second chance.
+// Returns 0 if two sweeps find nothing.
+static struct buf *
+block_evict(void)
+{
+	uint32_t nbuf = block_cache.stats.nbuf;
+
+	for (uint32_t n = 0; n < 2 * nbuf; n++) {
+		struct buf *b = block_nth(__sync_fetch_and_add(&block_cache.hand, 1) % nbuf);
+		int hi = __atomic_load_n(&b->bucket, __ATOMIC_RELAXED);
+
+		// Cheap checks first; they are redone under the lock.
+		// Even if refcnt==0, B_DIRTY indicates a buffer is in use
+		// because log.c has modified it but not yet committed it.
+		if (hi < 0 || b->refcnt != 0 || (b->flags & B_DIRTY))
+			continue;
+		if (b->used) {
+			b->used = 0;
+			continue;
+		}
+		bucket_acquire(hi);
+		if (b->bucket == hi && b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
+			b->prev->next = b->next;
+			b->next->prev = b->prev;
+			b->bucket = -1;
+			block_recycle(b, ~0U, ~0U);
+			release(&block_cache.bucket_lock[hi]);
+			return b;
+		}
+		release(&block_cache.bucket_lock[hi]);
+	}
+	return 0;
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
-// In either case, return locked buffer.
-static int i = 0;
-
+// In either case, return the buffer with a reference
+// taken but not locked. If every buffer is in use, wait for
+// one to be released, or return 0 if canfail is set.
 static struct buf *
-block_get(uint32_t dev, uint32_t blockno)
+block_find(uint32_t dev, uint32_t blockno, int canfail)
 {
-	struct buf *b;
-	int hi = hash(blockno);
+	struct buf *b, *victim;
+	int hi = hash(dev, blockno);
+	uint64_t nfreed;
 
-	// Find cache from bucket hi.
-	acquire(&block_cache.bucket_lock[hi]);
+again:
+	nfreed = __atomic_load_n(&block_cache.nfreed, __ATOMIC_SEQ_CST);
+	bucket_acquire(hi);
 	for (b = block_cache.bucket[hi].next; b != &block_cache.bucket[hi]; b = b->next) {
 		if (b->dev == dev && b->blockno == blockno) {
 			b->refcnt++;
+			b->used = 1;
 			release(&block_cache.bucket_lock[hi]);
-			acquiresleep(&b->lock);
 			return b;
 		}
 	}
-	// Not cached; recycle an unused buffer.
-	// Even if refcnt==0, B_DIRTY indicates a buffer is in use
-	// because log.c has modified it but not yet committed it.
-	for (b = block_cache.bucket[hi].prev; b != &block_cache.bucket[hi]; b = b->prev) {
-		if (b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-			b->dev = dev;
-			b->blockno = blockno;
-			b->flags = 0;
-			b->refcnt = 1;
+	release(&block_cache.bucket_lock[hi]);
+
+	// Not cached; recycle an unused buffer. No bucket lock is
+	// held while the clock runs, since it takes them itself.
+	if ((victim = block_evict()) == 0) {
+		if (canfail)
+			return 0;
+		// Sleep until block_unref() frees a buffer, unless
+		// one was freed while we were scanning.
+		acquire(&block_cache.waitlock);
+		__atomic_add_fetch(&block_cache.nwaiting, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&block_cache.nfreed, __ATOMIC_SEQ_CST) == nfreed)
+			sleep(&block_cache.nfreed, &block_cache.waitlock);
+		__atomic_sub_fetch(&block_cache.nwaiting, 1, __ATOMIC_SEQ_CST);
+		release(&block_cache.waitlock);
+		goto again;
+	}
+
+	bucket_acquire(hi);
+	// Someone may have cached the block while hi was unlocked.
+	// Then the victim goes back unused, in the bucket of its
+	// (~0, ~0) placeholder identity, which nothing looks up.
+	for (b = block_cache.bucket[hi].next; b != &block_cache.bucket[hi]; b = b->next) {
+		if (b->dev == dev && b->blockno == blockno) {
+			b->refcnt++;
+			b->used = 1;
 			release(&block_cache.bucket_lock[hi]);
-			acquiresleep(&b->lock);
+			block_unref(victim);
 			return b;
 		}
 	}
+	victim->dev = dev;
+	victim->blockno = blockno;
+	victim->used = 1;
+	bucket_insert(hi, victim);
 	release(&block_cache.bucket_lock[hi]);
-	// Find Recycle the least recently used (LRU) unused buffer.
-	if (i >= min(NBUCKET, ncpu))
-		i = 0;
-	for (; i < min(NBUCKET, ncpu); i++) {
-		// optimization: skip already checked hashed blockno
-		if (i == hi)
-			continue;
-		acquire(&block_cache.bucket_lock[i]);
-		for (b = block_cache.bucket[i].next; b != &block_cache.bucket[i]; b = b->next) {
-			if (b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-				//b->prev->next = b->next;
-				//b->next->prev = b->prev;
-				b->dev = dev;
-				b->blockno = blockno;
-				b->flags = 0;
-				b->refcnt = 1;
-				release(&block_cache.bucket_lock[i]);
-				acquiresleep(&b->lock);
-				return b;
-			}
+	return victim;
+}
+
+// Drop a reference taken by block_find().
+// A buffer taken out of the hash table by block_evict()
+// is put back in the bucket of its current identity.
+static void
+block_unref(struct buf *b)
+{
+	int hi = b->bucket;
+	int freed = 0;
+
+	if (hi < 0)
+		hi = hash(b->dev, b->blockno);
+	bucket_acquire(hi);
+	if (b->bucket < 0)
+		bucket_insert(hi, b);
+	b->refcnt--;
+	if (b->refcnt == 0)
+		freed = (b->flags & B_DIRTY) == 0;
+	release(&block_cache.bucket_lock[hi]);
+	if (freed) {
+		// A waiter counts itself before it looks at nfreed,
+		// so either it sees this increment or we see it.
+		__atomic_add_fetch(&block_cache.nfreed, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&block_cache.nwaiting, __ATOMIC_SEQ_CST) != 0) {
+			acquire(&block_cache.waitlock);
+			wakeup(&block_cache.nfreed);
+			release(&block_cache.waitlock);
 		}
-		release(&block_cache.bucket_lock[i]);
 	}
-	panic("bget: no buffers2");
+}
+
+// Return a locked buffer for block blockno of dev.
+static struct buf *
+block_get(uint32_t dev, uint32_t blockno)
+{
+	struct buf *b = block_find(dev, blockno, 0);
+
+	acquiresleep(&b->lock);
+	return b;
+}
+
+// Return a locked buf for the indicated block, filled with zeros
+// instead of being read, for a caller about to overwrite it.
+struct buf *
+block_get_zero(uint32_t dev, uint32_t blockno)
+{
+	struct buf *b = block_get(dev, blockno);
+
+	memset(b->data, 0, BSIZE);
+	b->flags |= B_VALID;
+	return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -134,11 +314,64 @@ block_read(uint32_t dev, uint32_t blockno)
 	struct buf *b;
 	b = block_get(dev, blockno);
 	if ((b->flags & B_VALID) == 0) {
+		__sync_add_and_fetch(&block_cache.stats.misses, 1);
 		iderw(b);
+	} else
+		__sync_add_and_fetch(&block_cache.stats.hits, 1);
+	if (b->flags & B_READAHEAD) {
+		b->flags &= ~B_READAHEAD;
+		__sync_add_and_fetch(&block_cache.stats.ra_hits, 1);
 	}
 	return b;
 }
 
+// Start reading the n blocks in blocknos of dev into the cache
+// and return without waiting. Blocks that are cached, or whose
+// buffer somebody else holds, are skipped.
+void
+block_prefetch(uint32_t dev, uint32_t *blocknos, int n)
+{
+	struct buf *bufs[n];
+	struct buf *b;
+	int nbufs = 0;
+
+	for (int j = 0; j < n; j++) {
+		// Running out of buffers just ends the read-ahead.
+		if ((b = block_find(dev, blocknos[j], 1)) == 0)
+			break;
+		if ((b->flags & (B_VALID | B_DIRTY)) != 0 || !tryacquiresleep(&b->lock)) {
+			block_unref(b);
+			continue;
+		}
+		if ((b->flags & (B_VALID | B_DIRTY)) != 0) {
+			releasesleep(&b->lock);
+			block_unref(b);
+			continue;
+		}
+		b->flags |= B_ASYNC | B_READAHEAD;
+		bufs[nbufs++] = b;
+	}
+	if (nbufs > 0) {
+		__sync_add_and_fetch(&block_cache.stats.ra_issued, nbufs);
+		iderw_async(bufs, nbufs);
+	}
+}
+
+// Called by the disk driver when a B_ASYNC buffer is done.
+void
+block_async_done(struct buf *b)
+{
+	b->flags &= ~B_ASYNC;
+	releasesleep(&b->lock);
+	block_unref(b);
+}
+
+void
+block_get_stats(struct bio_stats *st)
+{
+	*st = block_cache.stats;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 block_write(struct buf *b)
@@ -148,25 +381,24 @@ block_write(struct buf *b)
 	iderw(b);
 }
 
+// Write the contents of n locked buffers to disk at once,
+// so the disk queue can sort and merge them.
+void
+block_write_batch(struct buf **bufs, int n)
+{
+	for (int j = 0; j < n; j++) {
+		kernel_assert(holdingsleep(&bufs[j]->lock));
+		bufs[j]->flags |= B_DIRTY;
+	}
+	iderw_batch(bufs, n);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 block_release(struct buf *b)
 {
 	kernel_assert(holdingsleep(&b->lock));
 
 	releasesleep(&b->lock);
-
-	int hi = hash(b->blockno);
-	acquire(&block_cache.bucket_lock[hi]);
-	b->refcnt--;
-	if (b->refcnt == 0) {
-		b->next->prev = b->prev;
-		b->prev->next = b->next;
-		b->next = block_cache.bucket[hi].next;
-		b->prev = &block_cache.bucket[hi];
-		block_cache.bucket[hi].next->prev = b;
-		block_cache.bucket[hi].next = b;
-	}
-	release(&block_cache.bucket_lock[hi]);
+	block_unref(b);
 }
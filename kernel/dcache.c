@@ -0,0 +1,290 @@
+// Name cache.
+//
+// Remembers what looking up a name in a directory gave:
+// (dev, directory inum, name) -> inum, where an inum of 0 says
+// that the name does not exist. namex() asks it before locking
+// and reading the directory.
+//
+// The table is set-associative: a name hashes to one bucket of
+// DCACHE_WAYS entries, and replaces the least recently used one.
+// Writers hold the bucket's spinlock and make its sequence number
+// odd while they change it; readers take no lock, and retry if
+// the sequence number was odd or changed under them.
+//
+// To find a directory's name for getcwd(), a table indexed by
+// (dev, inum) remembers the last name entered for an inode that
+// hashes to each slot, and is trusted only while the cache still
+// has that entry.
+//
+// Entries are only added and removed with the directory's inode
+// lock held (see dirlookup()'s callers, dirlink() and dirunlink()),
+// so an entry can't be added from a lookup that a concurrent
+// unlink has already made stale. Names longer than DCACHE_NAMELEN
+// are not cached.
+
+#include <stdint.h>
+#include <string.h>
+#include "param.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "dcache.h"
+#include <sys/fsstat.h>
+
+#define DCACHE_NBUCKET 256
+#define DCACHE_WAYS 4
+#define DCACHE_NREV 256
+
+struct dentry {
+	uint32_t dev;
+	uint32_t parent; // directory inum, or 0 if the entry is unused
+	uint32_t inum; // 0 for a name known not to exist
+	uint32_t used; // tick of the last hit, for replacement
+	char name[DCACHE_NAMELEN];
+};
+
+struct dbucket {
+	struct spinlock lock;
+	uint32_t seq;
+	struct dentry ent[DCACHE_WAYS];
+};
+
+// The last name entered for an inode, by (dev, inum).
+struct drev {
+	struct spinlock lock;
+	uint32_t dev;
+	uint32_t inum;
+	uint32_t parent; // 0 if the slot is unused
+	char name[DCACHE_NAMELEN];
+};
+
+static struct {
+	struct dbucket bucket[DCACHE_NBUCKET];
+	struct drev rev[DCACHE_NREV];
+	uint32_t clock;
+	uint64_t hits, neghits, misses;
+} dcache;
+
+void
+dcache_init(void)
+{
+	for (int i = 0; i < DCACHE_NBUCKET; i++)
+		initlock(&dcache.bucket[i].lock, "dcache");
+	for (int i = 0; i < DCACHE_NREV; i++)
+		initlock(&dcache.rev[i].lock, "dcache.rev");
+}
+
+static struct drev *
+dcache_rev(uint32_t dev, uint32_t inum)
+{
+	return &dcache.rev[((dev * 0x9e3779b1U) ^ (inum * 0x85ebca6bU)) %
+										 DCACHE_NREV];
+}
+
+static struct dbucket *
+dcache_bucket(uint32_t dev, uint32_t parent, const char *name)
+{
+	uint32_t h = 2166136261U ^ dev ^ (parent * 0x9e3779b1U); // FNV-1a
+
+	for (size_t i = 0; i < DIRSIZ && name[i]; i++)
+		h = (h ^ (uint8_t)name[i]) * 16777619U;
+	return &dcache.bucket[h % DCACHE_NBUCKET];
+}
+
+static int
+dentry_match(const struct dentry *e, uint32_t dev, uint32_t parent,
+						 const char *name)
+{
+	return e->parent == parent && e->dev == dev &&
+				 strncmp(e->name, name, DCACHE_NAMELEN) == 0;
+}
+
+// Is name short enough to be cached?
+static int
+dname_fits(const char *name)
+{
+	for (int i = 0; i < DCACHE_NAMELEN; i++) {
+		if (name[i] == '\0')
+			return 1;
+	}
+	return 0;
+}
+
+static void
+dbucket_lock(struct dbucket *b)
+{
+	acquire(&b->lock);
+	__atomic_store_n(&b->seq, b->seq + 1, __ATOMIC_RELAXED);
+	__sync_synchronize();
+}
+
+static void
+dbucket_unlock(struct dbucket *b)
+{
+	__sync_synchronize();
+	__atomic_store_n(&b->seq, b->seq + 1, __ATOMIC_RELAXED);
+	release(&b->lock);
+}
+
+// Look name up in directory parent like dcache_lookup(), but
+// without counting it, to check again an answer already counted.
+int
+dcache_find(uint32_t dev, uint32_t parent, const char *name, uint32_t *inum)
+{
+	struct dbucket *b;
+	uint32_t seq, found;
+	int hit;
+
+	if (!dname_fits(name))
+		return 0;
+	b = dcache_bucket(dev, parent, name);
+	do {
+		seq = __atomic_load_n(&b->seq, __ATOMIC_ACQUIRE);
+		hit = 0;
+		found = 0;
+		if (seq & 1)
+			continue;
+		for (int i = 0; i < DCACHE_WAYS; i++) {
+			struct dentry *e = &b->ent[i];
+			if (dentry_match(e, dev, parent, name)) {
+				hit = 1;
+				found = e->inum;
+				e->used = dcache.clock;
+				break;
+			}
+		}
+		__sync_synchronize();
+	} while ((seq & 1) || __atomic_load_n(&b->seq, __ATOMIC_RELAXED) != seq);
+
+	if (hit)
+		*inum = found;
+	return hit;
+}
+
+// Look name up in directory parent. Returns 1 and sets *inum
+// if the answer is cached (*inum is 0 if the name does not
+// exist), or returns 0.
+int
+dcache_lookup(uint32_t dev, uint32_t parent, const char *name, uint32_t *inum)
+{
+	uint32_t found = 0;
+	int hit;
+
+	if (!dname_fits(name))
+		return 0;
+	hit = dcache_find(dev, parent, name, &found);
+	if (!hit)
+		__sync_add_and_fetch(&dcache.misses, 1);
+	else if (found == 0)
+		__sync_add_and_fetch(&dcache.neghits, 1);
+	else
+		__sync_add_and_fetch(&dcache.hits, 1);
+	if (hit)
+		*inum = found;
+	return hit;
+}
+
+// Record that name in directory parent is inum, or
+// doesn't exist if inum is 0. Caller holds parent's lock.
+void
+dcache_enter(uint32_t dev, uint32_t parent, const char *name, uint32_t inum)
+{
+	struct dbucket *b;
+	struct dentry *victim;
+
+	if (!dname_fits(name))
+		return;
+	b = dcache_bucket(dev, parent, name);
+	dbucket_lock(b);
+	victim = &b->ent[0];
+	for (int i = 0; i < DCACHE_WAYS; i++) {
+		struct dentry *e = &b->ent[i];
+		if (dentry_match(e, dev, parent, name)) {
+			victim = e;
+			break;
+		}
+		if (e->parent == 0 || (victim->parent != 0 && e->used < victim->used))
+			victim = e;
+	}
+	victim->dev = dev;
+	victim->parent = parent;
+	victim->inum = inum;
+	victim->used = __sync_add_and_fetch(&dcache.clock, 1);
+	strncpy(victim->name, name, DCACHE_NAMELEN);
+	dbucket_unlock(b);
+
+	if (inum != 0 && strcmp(name, ".") != 0 && strcmp(name, "..") != 0) {
+		struct drev *r = dcache_rev(dev, inum);
+		acquire(&r->lock);
+		r->dev = dev;
+		r->inum = inum;
+		r->parent = parent;
+		strncpy(r->name, name, DCACHE_NAMELEN);
+		release(&r->lock);
+	}
+}
+
+// Forget what name in directory parent is.
+// Caller holds parent's lock.
+void
+dcache_remove(uint32_t dev, uint32_t parent, const char *name)
+{
+	struct dbucket *b;
+
+	if (!dname_fits(name))
+		return;
+	b = dcache_bucket(dev, parent, name);
+	dbucket_lock(b);
+	for (int i = 0; i < DCACHE_WAYS; i++) {
+		if (dentry_match(&b->ent[i], dev, parent, name))
+			b->ent[i].parent = 0;
+	}
+	dbucket_unlock(b);
+}
+
+// Inode inum is being freed and its number may be reused:
+// forget every name in it and every name for it.
+void
+dcache_purge(uint32_t dev, uint32_t inum)
+{
+	for (int i = 0; i < DCACHE_NBUCKET; i++) {
+		struct dbucket *b = &dcache.bucket[i];
+		dbucket_lock(b);
+		for (int j = 0; j < DCACHE_WAYS; j++) {
+			struct dentry *e = &b->ent[j];
+			if (e->dev == dev && (e->parent == inum || e->inum == inum))
+				e->parent = 0;
+		}
+		dbucket_unlock(b);
+	}
+}
+
+// Find a name for directory inum in the cache, other than "."
+// and "..". Returns its parent's inum and copies the name to
+// name, or returns 0 if there is none.
+uint32_t
+dcache_reverse(uint32_t dev, uint32_t inum, char *name)
+{
+	struct drev *r = dcache_rev(dev, inum);
+	char rname[DCACHE_NAMELEN];
+	uint32_t parent = 0, found;
+
+	acquire(&r->lock);
+	if (r->parent != 0 && r->dev == dev && r->inum == inum) {
+		parent = r->parent;
+		strncpy(rname, r->name, DCACHE_NAMELEN);
+	}
+	release(&r->lock);
+	// The name may have been unlinked or renamed since.
+	if (parent == 0 || !dcache_find(dev, parent, rname, &found) || found != inum)
+		return 0;
+	strncpy(name, rname, DCACHE_NAMELEN);
+	return parent;
+}
+
+void
+dcache_get_stats(struct fsstat *st)
+{
+	st->dc_hits = dcache.hits;
+	st->dc_neghits = dcache.neghits;
+	st->dc_misses = dcache.misses;
+}
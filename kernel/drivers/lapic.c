@@ -13,12 +13,21 @@
 #include <string.h>
 #include "console.h"
 #include "spinlock.h"
+#include "param.h"
+#include "timer.h"
+#include "macros.h"
 
 
 volatile uint32_t *lapic; // Initialized in mp.c
 
 struct spinlock rtc_lock;
 
+#define CALIBRATE_MS 50
+
+static uint32_t lapic_hz; // timer counts per second
+static uint64_t tsc0; // rdtsc() at the start of nsec()
+static uint64_t tsc_mult; // nanoseconds per TSC count, times 2^32
+
 void
 lapicw(int index, int value)
 {
@@ -26,6 +35,85 @@ lapicw(int index, int value)
 	lapic[ID]; // wait for write to finish, by reading
 }
 
+// Time the timer and the TSC against the PIT, whose rate
+// is known. The TSC is taken to run at a constant rate, and
+// in step on every CPU, as it does on anything recent.
+static void
+lapic_calibrate(void)
+{
+	uint64_t t0, t1;
+	uint32_t left;
+
+	lapicw(TDCR, X1);
+	lapicw(TIMER, MASKED | ONE_SHOT | (T_IRQ0 + IRQ_TIMER));
+	lapicw(TICR, 0xffffffff);
+	t0 = rdtsc();
+	pit_wait(CALIBRATE_MS);
+	t1 = rdtsc();
+	left = lapic[TCCR];
+	lapic_hz = (uint64_t)(0xffffffff - left) * 1000 / CALIBRATE_MS;
+	tsc_mult = (1000000000ULL << 32) / ((t1 - t0) * 1000 / CALIBRATE_MS);
+	tsc0 = t1;
+	cprintf("lapic: timer %u kHz, tsc %lu kHz\n", lapic_hz / 1000,
+					(t1 - t0) / CALIBRATE_MS);
+}
+
+// Interrupt HZ times a second.
+void
+lapic_periodic(void)
+{
+	if (!lapic)
+		return;
+	lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
+	lapicw(TICR, lapic_hz / HZ);
+}
+
+// Interrupt once, ns nanoseconds from now, or in a second
+// if that is sooner, instead of HZ times a second.
+void
+lapic_oneshot(uint64_t ns)
+{
+	uint64_t count = min(ns, 1000000000ULL) * lapic_hz / 1000000000;
+
+	if (!lapic)
+		return;
+	lapicw(TIMER, ONE_SHOT | (T_IRQ0 + IRQ_TIMER));
+	lapicw(TICR, max(count, 1));
+}
+
+// Send the CPU with apicid an interrupt that does nothing
+// but end its hlt.
+void
+lapic_kick(uint8_t apicid)
+{
+	if (!lapic)
+		return;
+	lapicw(ICRHI, apicid << 24);
+	lapicw(ICRLO, FIXED | ASSERT | (T_IRQ0 + IRQ_WAKE));
+	while (lapic[ICRLO] & DELIVS)
+		;
+}
+
+// Nanoseconds since the boot CPU's local APIC was set up.
+uint64_t
+nsec(void)
+{
+	uint64_t t = rdtsc() - tsc0;
+
+	// t * tsc_mult >> 32, without overflowing 64 bits.
+	return (t >> 32) * tsc_mult + ((t & 0xffffffff) * tsc_mult >> 32);
+}
+
+// TSC counts in ns nanoseconds, for code that keeps time in
+// counts to spare itself nsec()'s arithmetic.
+uint64_t
+nsec_to_tsc(uint64_t ns)
+{
+	if (tsc_mult == 0)
+		return ns;
+	return (ns << 32) / tsc_mult;
+}
+
 void
 lapicinit(void)
 {
@@ -36,9 +124,8 @@ lapicinit(void)
 	lapicw(SVR, ENABLE | (T_IRQ0 + IRQ_SPURIOUS));
 
 	// The timer repeatedly counts down at bus frequency
-	// from lapic[TICR] and then issues an interrupt.
-	// If relix cared more about precise timekeeping,
-	// TICR would be calibrated using an external time source.
+	// from lapic[TICR] and then issues an interrupt, HZ
+	// times a second once the boot CPU has timed it.
 	uint32_t eax, ebx, ecx, edx;
 	cpuid(6, 0, &eax, &ebx, &ecx, &edx);
 	// considered the "ARAT" bit
@@ -48,9 +135,10 @@ lapicinit(void)
 	} else {
 		// APIC may stop during C-states or due to intel SpeedStep
 	}
+	if (lapic_hz == 0)
+		lapic_calibrate();
 	lapicw(TDCR, X1);
-	lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-	lapicw(TICR, 1000000);
+	lapic_periodic();
 
 	// Disable logical interrupt lines.
 	lapicw(LINT0, MASKED);
@@ -52,4 +52,14 @@ __suppress_sanitizer("alignment") void lapicstartap(uint8_t a, uint32_t b);
 void
 lapicw(int index, int value);
 void
+lapic_periodic(void);
+void
+lapic_oneshot(uint64_t ns);
+void
+lapic_kick(uint8_t apicid);
+uint64_t
+nsec(void);
+uint64_t
+nsec_to_tsc(uint64_t ns);
+void
 microdelay(int);
@@ -31,6 +31,9 @@
 #define KERNBASE (ULONG_MAX - PHYSLIMIT + 1) // 0xFFFFFFFF80000000ULL
 // First device virtual address
 #define DEVBASE (KERNBASE - 1 * GiB) // 0xFFFFFFFF40000000ULL
+// End of user memory: the top two entries of the user page
+// directory hold backpointers to the upper levels (see setupkvm).
+#define USERTOP 0x3fa00000
 #endif
 
 #ifndef __ASSEMBLER__
@@ -136,6 +136,10 @@ struct segdesc {
 #define PGROUNDUP(sz) \
 	(((sz) + (uintptr_t)PGSIZE - 1) & ~((uintptr_t)PGSIZE - 1))
 #define PGROUNDDOWN(a) (((a)) & ~((uintptr_t)PGSIZE - 1))
+// A page directory entry with PTE_PS maps one large page.
+#define HUGEPGSIZE ((uintptr_t)1 << PDXSHIFT)
+#define HUGEPGROUNDUP(sz) (((sz) + HUGEPGSIZE - 1) & ~(HUGEPGSIZE - 1))
+#define HUGEPGROUNDDOWN(a) (((a)) & ~(HUGEPGSIZE - 1))
 
 // Page table/directory entry flags.
 #define PTE_P 0x001 // Present
@@ -147,6 +151,8 @@ struct segdesc {
 #define PTE_D 0x040 // Dirty
 #define PTE_PS 0x080 // Page Size
 #define PTE_MBZ 0x180 // Bits must be zero
+// Bits 9-11 are ignored by the MMU and free for the kernel.
+#define PTE_COW 0x200 // Copy-on-write: writable once copied
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte) ((uintptr_t)(pte) & ~0xFFF)
@@ -11,6 +11,7 @@
 #include "kernel_assert.h"
 #include "vm.h"
 #include "drivers/mmu.h"
+#include "drivers/memlayout.h"
 #include "compiler_attributes.h"
 
 // count is argc/envc
@@ -40,12 +41,13 @@ push_user_stack(uintptr_t *count, char *const *vec, uintptr_t *ustack,
 __nonnull(1, 2) int execve(const char *path, char *const *argv, char *const *envp)
 {
 	const char *s, *last;
-	int i, off;
+	int i, off, n;
 	uintptr_t envc = 0;
 	uintptr_t argc = 0, sz, sp, ustack[3 + MAXARG + MAXENV + 1] = {};
 	struct Elf64_Ehdr elf;
 	struct inode *ip;
 	struct Elf64_Phdr ph;
+	struct vmarea areas[NVMAREA] = {};
 	uintptr_t *pgdir, *oldpgdir;
 	struct proc *curproc = myproc();
 
@@ -94,8 +96,10 @@ ok:
 	if ((pgdir = setupkvm()) == 0)
 		goto bad;
 
-	// Load program into memory.
+	// Record where each segment comes from. Nothing is read
+	// yet: pagefault() fills the pages in as they are touched.
 	sz = 0;
+	n = 0;
 	for (i = 0, off = elf.e_phoff; i < elf.e_phnum; i++, off += sizeof(ph)) {
 		if (inode_read(ip, (char *)&ph, off, sizeof(ph)) != sizeof(ph))
 			goto bad;
@@ -105,12 +109,21 @@ ok:
 			goto bad;
 		if (ph.p_vaddr + ph.p_memsz < ph.p_vaddr)
 			goto bad;
-		if ((sz = allocuvm(pgdir, sz, ph.p_vaddr + ph.p_memsz)) == 0)
+		if (ph.p_vaddr + ph.p_memsz >= USERTOP)
 			goto bad;
 		if (ph.p_vaddr % PGSIZE != 0)
 			goto bad;
-		if (loaduvm(pgdir, (char *)ph.p_vaddr, ip, ph.p_offset, ph.p_filesz) < 0)
+		if (n == NVMAREA)
 			goto bad;
+		areas[n].start = ph.p_vaddr;
+		areas[n].end = PGROUNDUP(ph.p_vaddr + ph.p_memsz);
+		areas[n].ip = inode_dup(ip);
+		areas[n].off = ph.p_offset;
+		areas[n].filesz = ph.p_filesz;
+		areas[n].perm = PTE_W | PTE_U;
+		n++;
+		if (ph.p_vaddr + ph.p_memsz > sz)
+			sz = ph.p_vaddr + ph.p_memsz;
 	}
 	inode_unlockput(ip);
 	end_op();
@@ -180,6 +193,10 @@ ok:
 		curproc->cred = curproc->parent->cred;
 	switchuvm(curproc);
 	freevm(oldpgdir);
+	begin_op();
+	vmareas_put(curproc->vmareas);
+	end_op();
+	memmove(curproc->vmareas, areas, sizeof(areas));
 	return 0;
 
 bad:
@@ -189,5 +206,8 @@ bad:
 		inode_unlockput(ip);
 		end_op();
 	}
+	begin_op();
+	vmareas_put(areas);
+	end_op();
 	return -1;
 }
@@ -15,22 +15,22 @@
 #include "log.h"
 #include "proc.h"
 #include "lseek.h"
+#include "macros.h"
+#include "dcache.h"
+#include "kalloc.h"
+#include "slab.h"
 
 struct devsw devsw[NDEV];
-struct {
-	struct spinlock lock;
-	struct file file[NFILE];
-} ftable;
 
-struct file *
-fd_to_struct_file(int fd)
-{
-	return myproc()->ofile[fd];
-}
+// struct files come from a slab cache, so there is no
+// system-wide limit on open files. Reference counts are
+// atomic and take no lock.
+static struct slab_cache *file_cache;
+
 void
 fileinit(void)
 {
-	initlock(&ftable.lock, "ftable");
+	file_cache = slab_cache_create("file", sizeof(struct file), 0);
 }
 
 // Allocate a file structure.
@@ -39,27 +39,19 @@ filealloc(void)
 {
 	struct file *f;
 
-	acquire(&ftable.lock);
-	for (f = ftable.file; f < ftable.file + NFILE; f++) {
-		if (f->ref == 0) {
-			f->ref = 1;
-			release(&ftable.lock);
-			return f;
-		}
-	}
-	release(&ftable.lock);
-	return 0;
+	if ((f = slab_alloc(file_cache)) == 0)
+		return 0;
+	memset(f, 0, sizeof(*f));
+	f->ref = 1;
+	return f;
 }
 
 // Increment ref count for file f.
 struct file *
 filedup(struct file *f)
 {
-	acquire(&ftable.lock);
-	if (unlikely(f->ref < 1))
+	if (unlikely(__sync_fetch_and_add(&f->ref, 1) < 1))
 		panic("filedup");
-	f->ref++;
-	release(&ftable.lock);
 	return f;
 }
 
@@ -68,18 +60,15 @@ void
 fileclose(struct file *f)
 {
 	struct file ff;
+	int ref;
 
-	acquire(&ftable.lock);
-	if (unlikely(f->ref < 1))
+	ref = __sync_sub_and_fetch(&f->ref, 1);
+	if (unlikely(ref < 0))
 		panic("fileclose");
-	if (--f->ref > 0) {
-		release(&ftable.lock);
+	if (ref > 0)
 		return;
-	}
 	ff = *f;
-	f->ref = 0;
-	f->type = FD_NONE;
-	release(&ftable.lock);
+	slab_free(file_cache, f);
 
 	if (ff.type == FD_PIPE)
 		pipeclose(ff.pipe, ff.writable);
@@ -90,6 +79,123 @@ fileclose(struct file *f)
 	}
 }
 
+// Per-process descriptor tables start with NOFILE slots and
+// double, up to NOFILE_MAX, when they fill. The pointers and
+// a bitmap of the descriptors in use share one allocation.
+
+static size_t
+fdtable_size(uint32_t n)
+{
+	return n * sizeof(struct file *) + (n + 63) / 64 * sizeof(uint64_t);
+}
+
+// Give p a table of n slots, keeping its open descriptors.
+static int
+fdtable_resize(struct proc *p, uint32_t n)
+{
+	struct file **ofile;
+	uint64_t *used;
+
+	if ((ofile = kcalloc(fdtable_size(n))) == 0)
+		return -ENOMEM;
+	used = (uint64_t *)(ofile + n);
+	if (p->ofile) {
+		memmove(ofile, p->ofile, p->nofile * sizeof(struct file *));
+		memmove(used, p->ofile_used, (p->nofile + 63) / 64 * sizeof(uint64_t));
+		kfree(p->ofile);
+	}
+	p->ofile = ofile;
+	p->ofile_used = used;
+	p->nofile = n;
+	return 0;
+}
+
+// The file open as fd in the current process, or 0.
+struct file *
+fd_to_struct_file(int fd)
+{
+	struct proc *p = myproc();
+
+	if (fd < 0 || (uint32_t)fd >= p->nofile)
+		return 0;
+	return p->ofile[fd];
+}
+
+// Install f as the lowest free descriptor of the current
+// process, growing its table if it is full. Takes over the
+// caller's reference to f on success.
+int
+fd_alloc(struct file *f)
+{
+	struct proc *p = myproc();
+	uint32_t fd, n;
+
+	for (uint32_t i = 0; i < (p->nofile + 63) / 64; i++) {
+		if (~p->ofile_used[i] == 0)
+			continue;
+		fd = i * 64 + __builtin_ctzl(~p->ofile_used[i]);
+		if (fd >= p->nofile)
+			break;
+		goto found;
+	}
+	fd = p->nofile;
+	n = p->nofile ? p->nofile * 2 : NOFILE;
+	if (fd >= NOFILE_MAX || fdtable_resize(p, n) < 0)
+		return -EMFILE;
+found:
+	p->ofile[fd] = f;
+	p->ofile_used[fd / 64] |= 1UL << (fd % 64);
+	return fd;
+}
+
+// Forget descriptor fd of the current process without closing
+// its file.
+void
+fd_clear(int fd)
+{
+	struct proc *p = myproc();
+
+	p->ofile[fd] = 0;
+	p->ofile_used[fd / 64] &= ~(1UL << (fd % 64));
+}
+
+// Give child np a copy of the current process's descriptors.
+int
+fd_copy(struct proc *np)
+{
+	struct proc *p = myproc();
+
+	if (p->nofile == 0)
+		return 0;
+	if (fdtable_resize(np, p->nofile) < 0)
+		return -ENOMEM;
+	for (uint32_t fd = 0; fd < p->nofile; fd++)
+		if (p->ofile[fd])
+			np->ofile[fd] = filedup(p->ofile[fd]);
+	memmove(np->ofile_used, p->ofile_used,
+					(p->nofile + 63) / 64 * sizeof(uint64_t));
+	return 0;
+}
+
+// Close every descriptor of the current process and free its table.
+void
+fd_closeall(void)
+{
+	struct proc *p = myproc();
+
+	for (uint32_t fd = 0; fd < p->nofile; fd++) {
+		if (p->ofile[fd]) {
+			fileclose(p->ofile[fd]);
+			p->ofile[fd] = 0;
+		}
+	}
+	if (p->ofile)
+		kfree(p->ofile);
+	p->ofile = 0;
+	p->ofile_used = 0;
+	p->nofile = 0;
+}
+
 // Get metadata about file f.
 int
 filestat(struct file *f, struct stat *st)
@@ -103,6 +209,32 @@ filestat(struct file *f, struct stat *st)
 	return -ENOENT;
 }
 
+// Called with f->ip locked after r bytes were read at f->off.
+// While reads keep picking up where the last one stopped, keep
+// a window of blocks beyond them being read into the cache,
+// doubling it up to RA_MAXBLOCKS.
+static void
+fileread_ahead(struct file *f, int r)
+{
+	uint32_t next = (f->off + r + BSIZE - 1) / BSIZE;
+
+	if (f->off != f->ra_next) {
+		f->ra_window = 0;
+		f->ra_end = 0;
+		f->ra_next = f->off + r;
+		return;
+	}
+	f->ra_next = f->off + r;
+	f->ra_window = f->ra_window ? min(2 * f->ra_window, RA_MAXBLOCKS) : 2;
+	// Only ask for what the last call did not already cover.
+	if (f->ra_end < next)
+		f->ra_end = next;
+	if (f->ra_end < next + f->ra_window) {
+		inode_readahead(f->ip, f->ra_end, next + f->ra_window - f->ra_end);
+		f->ra_end = next + f->ra_window;
+	}
+}
+
 // Read from file f.
 int
 fileread(struct file *f, char *addr, int n)
@@ -115,8 +247,10 @@ fileread(struct file *f, char *addr, int n)
 		return piperead(f->pipe, addr, n);
 	if (f->type == FD_INODE) {
 		inode_lock(f->ip);
-		if ((r = inode_read(f->ip, addr, f->off, n)) > 0)
+		if ((r = inode_read(f->ip, addr, f->off, n)) > 0) {
+			fileread_ahead(f, r);
 			f->off += r;
+		}
 		inode_unlock(f->ip);
 		return r;
 	}
@@ -152,6 +286,7 @@ filewrite(struct file *f, char *addr, int n)
 	if (f->type == FD_PIPE)
 		return pipewrite(f->pipe, addr, n);
 	if (f->type == FD_INODE) {
+		uint64_t seq = 0;
 		// write a few blocks at a time to avoid exceeding
 		// the maximum log transaction size, including
 		// i-node, indirect block, allocation blocks,
@@ -169,6 +304,7 @@ filewrite(struct file *f, char *addr, int n)
 			inode_lock(f->ip);
 			if ((r = inode_write(f->ip, addr + i, f->off, n1)) > 0)
 				f->off += r;
+			seq = f->ip->logseq;
 			inode_unlock(f->ip);
 			end_op();
 
@@ -178,6 +314,8 @@ filewrite(struct file *f, char *addr, int n)
 				panic("short filewrite");
 			i += r;
 		}
+		if (f->sync)
+			log_force(seq);
 		return i == n ? n : -EDOM;
 	}
 	panic("filewrite");
@@ -207,31 +345,44 @@ inode_to_path(char *buf, size_t n, struct inode *ip)
 {
 	struct inode *parent;
 	char node_name[DIRSIZ];
-	bool isroot, isdir;
-	inode_lock(ip);
-	isroot = ip->inum == namei("/")->inum;
-	isdir = S_ISDIR(ip->mode);
-	inode_unlock(ip);
+	uint32_t pinum;
+	bool isdir;
+	char *s;
 
-	if (isroot) {
+	if (ip->dev == ROOTDEV && ip->inum == ROOTINO) {
 		buf[0] = '/';
 		buf[1] = '\0';
 		return buf;
-	} else if (isdir) {
+	}
+	inode_lock(ip);
+	isdir = S_ISDIR(ip->mode);
+	inode_unlock(ip);
+	if (!isdir)
+		return NULL;
+
+	// The name cache usually knows the directory's name
+	// and parent; otherwise read ".." and search it.
+	if ((pinum = dcache_reverse(ip->dev, ip->inum, node_name)) != 0) {
+		parent = inode_get(ip->dev, pinum);
+	} else {
 		inode_lock(ip);
 		parent = dirlookup(ip, "..", 0);
 		inode_unlock(ip);
+		if (parent == NULL)
+			return NULL;
 		inode_lock(parent);
 		if (name_of_inode(ip, parent, node_name, n) < 0) {
+			inode_unlockput(parent);
 			return NULL;
 		}
 		inode_unlock(parent);
-		char *s = inode_to_path(buf, n, parent);
-		if (strcmp(s, "/") != 0) {
-			strncat(s, "/", 2);
-		}
-		return strncat(s, node_name, DIRSIZ - strlen(node_name));
-	} else {
+	}
+	s = inode_to_path(buf, n, parent);
+	inode_put(parent);
+	if (s == NULL)
 		return NULL;
+	if (strcmp(s, "/") != 0) {
+		strncat(s, "/", 2);
 	}
+	return strncat(s, node_name, DIRSIZ - strlen(node_name));
 }
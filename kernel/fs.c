@@ -29,9 +29,18 @@
 #include "console.h"
 #include "drivers/lapic.h"
 #include "macros.h"
+#include "kalloc.h"
+#include "slab.h"
+#include "x86.h"
+#include "dcache.h"
+#include <sys/fsstat.h>
 
 static void
 inode_truncate(struct inode *);
+static void
+dirindex_drop(struct inode *);
+extern uint64_t available_memory;
+
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock global_sb;
@@ -47,41 +56,123 @@ read_superblock(int dev, struct superblock *sb)
 	block_release(bp);
 }
 
-// Zero a block.
+// Zero a block. There is no need to read it first.
 static void
 bzero(int dev, int bno)
 {
 	struct buf *bp;
 
-	bp = block_read(dev, bno);
-	memset(bp->data, 0, BSIZE);
+	bp = block_get_zero(dev, bno);
 	log_write(bp);
 	block_release(bp);
 }
 
 // Blocks.
+//
+// The bitmap is indexed in memory by groups of BGROUP blocks,
+// each with a count of its free blocks, so allocation can skip
+// full groups without reading their part of the bitmap. A group
+// lies within one bitmap block, whose lock protects its count.
+// The counts are built from the bitmap at mount time.
+
+#define BGROUP 512
+
+static struct {
+	uint32_t ngroups;
+	uint32_t *gfree; // free blocks per group
+	uint32_t rotor; // where allocations without a goal start
+	struct fsstat stats;
+} balloc;
+
+// Count the free blocks of each group.
+void
+block_index_init(uint32_t dev)
+{
+	struct buf *bp = 0;
+
+	balloc.ngroups = (global_sb.size + BGROUP - 1) / BGROUP;
+	if ((balloc.gfree = kcalloc(balloc.ngroups * sizeof(uint32_t))) == NULL)
+		panic("block_index_init");
+	for (uint32_t b = 0; b < global_sb.size; b++) {
+		if (b % BPB == 0) {
+			if (bp)
+				block_release(bp);
+			bp = block_read(dev, BBLOCK(b, global_sb));
+		}
+		if ((bp->data[(b % BPB) / 8] & (1 << (b % 8))) == 0)
+			balloc.gfree[b / BGROUP]++;
+	}
+	if (bp)
+		block_release(bp);
+	balloc.stats.nblocks = global_sb.size;
+}
+
+// Find the first clear bit in map from bit from up to bit to,
+// or return -1. Looks at whole words where it can.
+static int
+bitmap_find(const uint8_t *map, int from, int to)
+{
+	const uint64_t *w = (const uint64_t *)map;
+	int b = from;
 
-// Allocate a zeroed disk block.
+	while (b < to && b % 64 != 0) {
+		if ((map[b / 8] & (1 << (b % 8))) == 0)
+			return b;
+		b++;
+	}
+	for (; b + 64 <= to; b += 64) {
+		if (w[b / 64] != ~0UL)
+			return b + __builtin_ctzl(~w[b / 64]);
+	}
+	for (; b < to; b++) {
+		if ((map[b / 8] & (1 << (b % 8))) == 0)
+			return b;
+	}
+	return -1;
+}
+
+// Allocate a zeroed disk block, as close after goal as possible
+// so that files end up contiguous. A goal of 0 means anywhere.
 static uint32_t
-block_alloc(uint32_t dev)
+block_alloc(uint32_t dev, uint32_t goal)
 {
-	int b, bi, m;
+	uint64_t t0 = rdtsc(), t;
 	struct buf *bp;
+	int bi;
 
-	bp = 0;
-	for (b = 0; b < global_sb.size; b += BPB) {
-		bp = block_read(dev, BBLOCK(b, global_sb));
-		for (bi = 0; bi < BPB && b + bi < global_sb.size; bi++) {
-			m = 1 << (bi % 8);
-			if ((bp->data[bi / 8] & m) == 0) { // Is block free?
-				bp->data[bi / 8] |= m; // Mark block in use.
-				log_write(bp);
-				block_release(bp);
-				bzero(dev, b + bi);
-				return b + bi;
-			}
+	if (goal == 0 || goal >= global_sb.size)
+		goal = balloc.rotor;
+	// One extra step to look at the start of the first group.
+	for (uint32_t n = 0; n <= balloc.ngroups; n++) {
+		uint32_t g = (goal / BGROUP + n) % balloc.ngroups;
+		uint32_t from = n == 0 ? goal : g * BGROUP;
+		uint32_t to = min((g + 1) * BGROUP, global_sb.size);
+
+		if (__atomic_load_n(&balloc.gfree[g], __ATOMIC_RELAXED) == 0)
+			continue;
+		bp = block_read(dev, BBLOCK(from, global_sb));
+		bi = bitmap_find(bp->data, from % BPB, (to - 1) % BPB + 1);
+		if (bi < 0) {
+			block_release(bp);
+			continue;
 		}
+		bp->data[bi / 8] |= 1 << (bi % 8); // Mark block in use.
+		log_write(bp);
+		balloc.gfree[g]--;
 		block_release(bp);
+
+		uint32_t b = from - from % BPB + bi;
+		balloc.rotor = b + 1;
+		bzero(dev, b);
+
+		t = rdtsc() - t0;
+		__sync_add_and_fetch(&balloc.stats.allocs, 1);
+		if (b == goal)
+			__sync_add_and_fetch(&balloc.stats.contiguous, 1);
+		__sync_add_and_fetch(&balloc.stats.latency, t);
+		if (t > balloc.stats.maxlatency)
+			balloc.stats.maxlatency = t;
+		return b;
 	}
 	panic("block_alloc: out of blocks");
 }
@@ -100,7 +191,37 @@ block_free(int dev, uint32_t b)
 		panic("freeing free block");
 	bp->data[bi / 8] &= ~m;
 	log_write(bp);
+	balloc.gfree[b / BGROUP]++;
 	block_release(bp);
+	__sync_add_and_fetch(&balloc.stats.frees, 1);
+}
+
+// Fill in *st with the allocator's counters and a
+// picture of how fragmented the free space is.
+void
+balloc_get_stats(uint32_t dev, struct fsstat *st)
+{
+	struct buf *bp = 0;
+	uint32_t run = 0;
+
+	*st = balloc.stats;
+	st->nfree = st->nextents = st->maxextent = 0;
+	for (uint32_t b = 0; b < global_sb.size; b++) {
+		if (b % BPB == 0) {
+			if (bp)
+				block_release(bp);
+			bp = block_read(dev, BBLOCK(b, global_sb));
+		}
+		if ((bp->data[(b % BPB) / 8] & (1 << (b % 8))) == 0) {
+			if (run++ == 0)
+				st->nextents++;
+			st->nfree++;
+			st->maxextent = max(st->maxextent, run);
+		} else
+			run = 0;
+	}
+	if (bp)
+		block_release(bp);
 }
 
 // Inodes.
@@ -163,33 +284,81 @@ block_free(int dev, uint32_t b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The inode_cache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold inode_cache.lock while using any of those fields.
+// The inode cache is a hash table on (dev, inum) with a spin-lock
+// per bucket, which protects the hash chains and ip->ref, ip->dev
+// and ip->inum of the inodes on them. Inodes whose ref drops to 0
+// stay cached, valid, on an LRU list protected by
+// inode_cache.lru_lock, and are reused least recently used first.
+// Free entries (inum 0) sit at the cold end of that list.
+// Bucket locks are taken before lru_lock.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
-#define NBUCKET NCPU
+#define NIBUCKET 251
+
 struct {
-	struct spinlock lock[NBUCKET];
-	struct inode inode[NINODE][NBUCKET];
+	struct spinlock lock[NIBUCKET];
+	struct inode *bucket[NIBUCKET];
+	struct spinlock lru_lock;
+	struct inode lru; // list head; lru.lru_next is the most recent
+	uint32_t ninode;
+	struct slab_cache *slab;
 } inode_cache;
 
+static int
+inode_hash(uint32_t dev, uint32_t inum)
+{
+	return (inum ^ (dev * 0x9e3779b1U)) % NIBUCKET;
+}
+
+// Put ip on the LRU list, at the hot end unless cold is set.
+// Caller holds lru_lock.
+static void
+inode_lru_add(struct inode *ip, int cold)
+{
+	struct inode *at = cold ? inode_cache.lru.lru_prev : &inode_cache.lru;
+
+	ip->lru_next = at->lru_next;
+	ip->lru_prev = at;
+	at->lru_next->lru_prev = ip;
+	at->lru_next = ip;
+}
+
+// Caller holds lru_lock.
+static void
+inode_lru_del(struct inode *ip)
+{
+	ip->lru_prev->lru_next = ip->lru_next;
+	ip->lru_next->lru_prev = ip->lru_prev;
+	ip->lru_next = ip->lru_prev = 0;
+}
+
+// Size the inode cache from the amount of memory.
 void
 inode_init(int dev)
 {
-	for (int i = 0; i < min(NBUCKET, ncpu); i++) {
+	struct inode *ip;
+	uint32_t n;
+
+	for (int i = 0; i < NIBUCKET; i++)
 		initlock(&inode_cache.lock[i], "inode.bucket");
+	initlock(&inode_cache.lru_lock, "inode.lru");
+	inode_cache.lru.lru_next = inode_cache.lru.lru_prev = &inode_cache.lru;
+
+	inode_cache.slab = slab_cache_create("inode", sizeof(struct inode), 0);
+	n = available_memory / INODE_MEMSHARE / sizeof(struct inode);
+	n = min(max(n, NINODE), NINODE_MAX);
+	for (inode_cache.ninode = 0; inode_cache.ninode < n; inode_cache.ninode++) {
+		if ((ip = slab_alloc(inode_cache.slab)) == NULL)
+			break;
+		memset(ip, 0, sizeof(*ip));
+		initsleeplock(&ip->lock, "inode");
+		inode_lru_add(ip, 1);
 	}
-	//initlock(&inode_cache.lock, "icache");
-	for (int j = 0; j < min(NBUCKET, ncpu); j++) {
-		for (int i = 0; i < NINODE; i++) {
-			initsleeplock(&inode_cache.inode[i][j].lock, "inode");
-		}
-	}
+	if (inode_cache.ninode < NINODE)
+		panic("inode_init");
 
 	read_superblock(dev, &global_sb);
 	cprintf("sb: size %lu nblocks %lu ninodes %lu nlog %lu logstart %lu\
@@ -198,9 +367,6 @@ inode_init(int dev)
 					global_sb.logstart, global_sb.inodestart, global_sb.bmapstart);
 }
 
-static struct inode *
-inode_get(uint32_t dev, uint32_t inum);
-
 // Allocate an inode on device dev.
 // Mark it as allocated by giving it type type.
 // Returns an unlocked but allocated and referenced inode.
@@ -259,64 +425,90 @@ inode_update(struct inode *ip)
 	memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
 	log_write(bp);
 	block_release(bp);
+	log_mark(ip);
 }
 
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
-static struct inode *
+struct inode *
 inode_get(uint32_t dev, uint32_t inum)
 {
-	struct inode *ip, *empty;
-
-	int hash = dev % min(NBUCKET, ncpu);
-	acquire(&inode_cache.lock[hash]);
+	struct inode *ip, *victim;
+	int hi = inode_hash(dev, inum), vi;
 
 	// Is the inode already cached?
-	empty = 0;
-	for (ip = &inode_cache.inode[0][hash];
-			 ip < &inode_cache.inode[NINODE - 1][hash];
-			 ip++) {
-		if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
-			ip->ref++;
-			release(&inode_cache.lock[hash]);
+	acquire(&inode_cache.lock[hi]);
+	for (ip = inode_cache.bucket[hi]; ip; ip = ip->hnext) {
+		if (ip->dev == dev && ip->inum == inum) {
+			if (ip->ref++ == 0) {
+				acquire(&inode_cache.lru_lock);
+				inode_lru_del(ip);
+				release(&inode_cache.lru_lock);
+			}
+			release(&inode_cache.lock[hi]);
 			return ip;
 		}
-		if (empty == 0 && ip->ref == 0) // Remember empty slot.
-			empty = ip;
-	}
-	if (empty == 0) {
-		for (int i = 0; i < min(NBUCKET, ncpu); i++) {
-			// Skip over the node that we already checked.
-			// This also avoids a deadlock.
-			if (i == hash)
-				continue;
-			acquire(&inode_cache.lock[i]);
-			for (ip = &inode_cache.inode[0][i]; ip < &inode_cache.inode[NINODE - 1][i];
-			  	 ip++) {
-
-				if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
-					ip->ref++;
-					release(&inode_cache.lock[i]);
-					return ip;
-				}
-				if (empty == 0 && ip->ref == 0) // Remember empty slot.
-					empty = ip;
-			}
-			release(&inode_cache.lock[i]);
+	}
+	release(&inode_cache.lock[hi]);
+
+	// Recycle the least recently used unreferenced entry.
+	// Taking it out of its own bucket needs that bucket's
+	// lock, which comes before lru_lock, so look, then lock
+	// and check again.
+	for (;;) {
+		acquire(&inode_cache.lru_lock);
+		victim = inode_cache.lru.lru_prev;
+		if (victim == &inode_cache.lru)
+			panic("inode_get: no inodes");
+		if (victim->inum == 0) {
+			inode_lru_del(victim);
+			release(&inode_cache.lru_lock);
+			break;
 		}
+		vi = inode_hash(victim->dev, victim->inum);
+		release(&inode_cache.lru_lock);
+
+		acquire(&inode_cache.lock[vi]);
+		acquire(&inode_cache.lru_lock);
+		if (victim->ref == 0 && victim->lru_next != 0 &&
+				inode_hash(victim->dev, victim->inum) == vi) {
+			struct inode **pp = &inode_cache.bucket[vi];
+			while (*pp != victim)
+				pp = &(*pp)->hnext;
+			*pp = victim->hnext;
+			inode_lru_del(victim);
+			victim->inum = 0;
+			release(&inode_cache.lru_lock);
+			release(&inode_cache.lock[vi]);
+			break;
+		}
+		release(&inode_cache.lru_lock);
+		release(&inode_cache.lock[vi]);
 	}
-
-	// Recycle an inode cache entry.
-	if (empty == 0)
-		panic("inode_get: no inodes");
-
-	ip = empty;
+	dirindex_drop(victim);
+
+	acquire(&inode_cache.lock[hi]);
+	// Someone may have cached the inode while hi was unlocked.
+	for (ip = inode_cache.bucket[hi]; ip; ip = ip->hnext) {
+		if (ip->dev == dev && ip->inum == inum) {
+			acquire(&inode_cache.lru_lock);
+			if (ip->ref++ == 0)
+				inode_lru_del(ip);
+			inode_lru_add(victim, 1);
+			release(&inode_cache.lru_lock);
+			release(&inode_cache.lock[hi]);
+			return ip;
+		}
+	}
+	ip = victim;
 	ip->dev = dev;
 	ip->inum = inum;
 	ip->ref = 1;
 	ip->valid = 0;
-	release(&inode_cache.lock[hash]);
+	ip->hnext = inode_cache.bucket[hi];
+	inode_cache.bucket[hi] = ip;
+	release(&inode_cache.lock[hi]);
 
 	return ip;
 }
@@ -326,10 +518,11 @@ inode_get(uint32_t dev, uint32_t inum)
 struct inode *
 inode_dup(struct inode *ip)
 {
-	__sync_add_and_fetch(&ip->ref, 1);
-	//acquire(&inode_cache.lock);
-	//ip->ref++;
-	//release(&inode_cache.lock);
+	int hi = inode_hash(ip->dev, ip->inum);
+
+	acquire(&inode_cache.lock[hi]);
+	ip->ref++;
+	release(&inode_cache.lock[hi]);
 	return ip;
 }
 
@@ -363,6 +556,9 @@ inode_lock(struct inode *ip)
 
 		memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
 		block_release(bp);
+		// Which transaction last changed it was lost with the
+		// cached copy, so assume the latest it could be.
+		ip->logseq = log_seq();
 		ip->valid = 1;
 		if (ip->mode == 0)
 			panic("inode_lock: no mode");
@@ -390,14 +586,18 @@ inode_unlock(struct inode *ip)
 void
 inode_put(struct inode *ip)
 {
+	int hi = inode_hash(ip->dev, ip->inum);
+
 	acquiresleep(&ip->lock);
 	if (ip->valid && ip->nlink == 0) {
-		acquire(&inode_cache.lock[1]);
+		acquire(&inode_cache.lock[hi]);
 		int r = ip->ref;
-		release(&inode_cache.lock[1]);
+		release(&inode_cache.lock[hi]);
 		if (r == 1) {
 			// inode has no links and no other references: truncate and free.
 			inode_truncate(ip);
+			dirindex_drop(ip);
+			dcache_purge(ip->dev, ip->inum);
 			ip->mode = 0;
 			inode_update(ip);
 			ip->valid = 0;
@@ -405,10 +605,14 @@ inode_put(struct inode *ip)
 	}
 	releasesleep(&ip->lock);
 
-	//acquire(&inode_cache.lock);
-	__sync_sub_and_fetch(&ip->ref, 1);
-	//ip->ref--;
-	//release(&inode_cache.lock);
+	// Unreferenced inodes stay cached until they are reused.
+	acquire(&inode_cache.lock[hi]);
+	if (--ip->ref == 0) {
+		acquire(&inode_cache.lru_lock);
+		inode_lru_add(ip, 0);
+		release(&inode_cache.lru_lock);
+	}
+	release(&inode_cache.lock[hi]);
 }
 
 // Common idiom: unlock, then put.
@@ -431,25 +635,31 @@ inode_unlockput(struct inode *ip)
 static uint32_t
 bmap(struct inode *ip, uint32_t bn)
 {
-	uint32_t addr, *a;
+	uint32_t addr, *a, goal;
 	struct buf *bp;
 
 	kernel_assert(holdingsleep(&ip->lock));
+	// New blocks go right after the one before them, if possible.
 	if (bn < NDIRECT) {
-		if ((addr = ip->addrs[bn]) == 0)
-			ip->addrs[bn] = addr = block_alloc(ip->dev);
+		if ((addr = ip->addrs[bn]) == 0) {
+			goal = bn > 0 && ip->addrs[bn - 1] ? ip->addrs[bn - 1] + 1 : 0;
+			ip->addrs[bn] = addr = block_alloc(ip->dev, goal);
+		}
 		return addr;
 	}
 	bn -= NDIRECT;
 
 	if (bn < NINDIRECT) {
 		// Load indirect block, allocating if necessary.
-		if ((addr = ip->addrs[NDIRECT]) == 0)
-			ip->addrs[NDIRECT] = addr = block_alloc(ip->dev);
+		if ((addr = ip->addrs[NDIRECT]) == 0) {
+			goal = ip->addrs[NDIRECT - 1] ? ip->addrs[NDIRECT - 1] + 1 : 0;
+			ip->addrs[NDIRECT] = addr = block_alloc(ip->dev, goal);
+		}
 		bp = block_read(ip->dev, addr);
 		a = (uint32_t *)bp->data;
 		if ((addr = a[bn]) == 0) {
-			a[bn] = addr = block_alloc(ip->dev);
+			goal = bn > 0 && a[bn - 1] ? a[bn - 1] + 1 : bp->blockno + 1;
+			a[bn] = addr = block_alloc(ip->dev, goal);
 			log_write(bp);
 		}
 		block_release(bp);
@@ -462,13 +672,14 @@ bmap(struct inode *ip, uint32_t bn)
 	if (bn < NINDIRECT * NINDIRECT) {
 		// Load indirect block, allocating if necessary.
 		if ((addr = ip->addrs[NDIRECT + 1]) == 0)
-			ip->addrs[NDIRECT + 1] = addr = block_alloc(ip->dev);
+			ip->addrs[NDIRECT + 1] = addr = block_alloc(ip->dev, 0);
 		bp = block_read(ip->dev, addr);
 		a = (uint32_t *)bp->data;
 		uint32_t double_index = bn / NINDIRECT;
 
 		if ((addr = a[double_index]) == 0) {
-			a[double_index] = addr = block_alloc(ip->dev);
+			goal = double_index > 0 && a[double_index - 1] ? a[double_index - 1] + 1 : bp->blockno + 1;
+			a[double_index] = addr = block_alloc(ip->dev, goal);
 			log_write(bp);
 		}
 		block_release(bp);
@@ -479,7 +690,8 @@ bmap(struct inode *ip, uint32_t bn)
 
 		// load doubly indirect block
 		if ((addr = a[pos]) == 0) {
-			a[pos] = addr = block_alloc(ip->dev);
+			goal = pos > 0 && a[pos - 1] ? a[pos - 1] + 1 : bp->blockno + 1;
+			a[pos] = addr = block_alloc(ip->dev, goal);
 			log_write(bp);
 		}
 		block_release(bp);
@@ -603,6 +815,25 @@ inode_read(struct inode *ip, char *dst, uint64_t off, uint64_t n)
 	return n;
 }
 
+// Start reading blocks [bn, bn + n) of ip into the cache without
+// waiting for them. Blocks past the end of the file are skipped.
+// Caller must hold ip->lock.
+void
+inode_readahead(struct inode *ip, uint32_t bn, uint32_t n)
+{
+	uint32_t addrs[RA_MAXBLOCKS];
+	uint32_t i;
+
+	kernel_assert(holdingsleep(&ip->lock));
+	if (!S_ISREG(ip->mode))
+		return;
+	n = min(n, RA_MAXBLOCKS);
+	for (i = 0; i < n && (uint64_t)(bn + i) * BSIZE < ip->size; i++)
+		addrs[i] = bmap(ip, bn + i);
+	if (i > 0)
+		block_prefetch(ip->dev, addrs, i);
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 int
@@ -630,6 +861,7 @@ inode_write(struct inode *ip, char *src, uint64_t off, uint64_t n)
 		log_write(bp);
 		block_release(bp);
 	}
+	log_mark(ip);
 
 	if (n > 0 && off > ip->size) {
 		ip->size = off;
@@ -646,6 +878,140 @@ namecmp(const char *s, const char *t)
 	return strncmp(s, t, DIRSIZ);
 }
 
+// Directories with at least DIRINDEX_MIN entries get an
+// in-memory hash index from entry name to entry number, built
+// on first lookup and kept up to date by dirlink() and dirunlink()
+// for as long as the inode stays cached. The disk format is
+// unchanged. Slots are open-addressed, spread over page frames,
+// and hold the name's hash so that lookups only read entries
+// whose hash matches. ip->lock protects the index.
+
+#define DIRINDEX_MIN 64
+#define DIRINDEX_MAXPAGES 64
+
+struct dirslot {
+	uint32_t hash;
+	uint32_t ent; // entry number + 1, or DIRSLOT_EMPTY or _DELETED
+};
+#define DIRSLOT_EMPTY 0
+#define DIRSLOT_DELETED ~0U
+#define DIRSLOTS_PER_PAGE (PGSIZE / sizeof(struct dirslot))
+
+struct dirindex {
+	uint32_t nslots; // a power of two
+	uint32_t nused; // slots that are not empty, deleted ones included
+	uint32_t firstfree; // no free entry comes before this one
+	struct dirslot *pages[DIRINDEX_MAXPAGES];
+};
+
+static uint32_t
+dirhash(const char *name)
+{
+	uint32_t h = 2166136261U; // FNV-1a
+
+	for (size_t i = 0; i < DIRSIZ && name[i]; i++)
+		h = (h ^ (uint8_t)name[i]) * 16777619U;
+	return h;
+}
+
+static struct dirslot *
+dirindex_slot(struct dirindex *di, uint32_t i)
+{
+	return &di->pages[i / DIRSLOTS_PER_PAGE][i % DIRSLOTS_PER_PAGE];
+}
+
+// Forget ip's directory index, if it has one.
+static void
+dirindex_drop(struct inode *ip)
+{
+	struct dirindex *di = ip->dindex;
+
+	if (di == NULL)
+		return;
+	for (int i = 0; i < DIRINDEX_MAXPAGES && di->pages[i]; i++)
+		kpage_free((char *)di->pages[i]);
+	kfree(di);
+	ip->dindex = NULL;
+}
+
+static void
+dirindex_insert(struct dirindex *di, uint32_t hash, uint32_t ent)
+{
+	uint32_t i = hash & (di->nslots - 1);
+	struct dirslot *s;
+
+	while ((s = dirindex_slot(di, i))->ent != DIRSLOT_EMPTY &&
+				 s->ent != DIRSLOT_DELETED)
+		i = (i + 1) & (di->nslots - 1);
+	if (s->ent == DIRSLOT_EMPTY)
+		di->nused++;
+	s->hash = hash;
+	s->ent = ent + 1;
+}
+
+static void
+dirindex_remove(struct dirindex *di, uint32_t hash, uint32_t ent)
+{
+	uint32_t i = hash & (di->nslots - 1);
+	struct dirslot *s;
+
+	while ((s = dirindex_slot(di, i))->ent != DIRSLOT_EMPTY) {
+		if (s->ent == ent + 1) {
+			s->ent = DIRSLOT_DELETED;
+			return;
+		}
+		i = (i + 1) & (di->nslots - 1);
+	}
+}
+
+// Build an index of dp with room for twice its entries.
+// Returns 0 if dp is too big to index or memory is short.
+static struct dirindex *
+dirindex_build(struct inode *dp)
+{
+	struct dirindex *di;
+	struct dirent de;
+	uint32_t nent = dp->size / sizeof(de), npages;
+
+	if ((di = kcalloc(sizeof(*di))) == NULL)
+		return NULL;
+	di->nslots = DIRSLOTS_PER_PAGE;
+	while (di->nslots < 2 * nent)
+		di->nslots *= 2;
+	npages = di->nslots / DIRSLOTS_PER_PAGE;
+	if (npages > DIRINDEX_MAXPAGES) {
+		kfree(di);
+		return NULL;
+	}
+	for (uint32_t i = 0; i < npages; i++) {
+		if ((di->pages[i] = (struct dirslot *)kpage_alloc()) == NULL) {
+			dp->dindex = di;
+			dirindex_drop(dp);
+			return NULL;
+		}
+		memset(di->pages[i], 0, PGSIZE);
+	}
+	di->firstfree = nent;
+	for (uint32_t ent = 0; ent < nent; ent++) {
+		if (inode_read(dp, (char *)&de, ent * sizeof(de), sizeof(de)) != sizeof(de))
+			panic("dirindex read");
+		if (de.d_ino != 0)
+			dirindex_insert(di, dirhash(de.d_name), ent);
+		else if (ent < di->firstfree)
+			di->firstfree = ent;
+	}
+	return di;
+}
+
+// Return dp's index, building it if dp has become big enough.
+static struct dirindex *
+dirindex_get(struct inode *dp)
+{
+	if (dp->dindex == NULL && dp->size / sizeof(struct dirent) >= DIRINDEX_MIN)
+		dp->dindex = dirindex_build(dp);
+	return dp->dindex;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 // Caller needs to hold dp->lock.
@@ -655,68 +1021,112 @@ dirlookup(struct inode *dp, const char *name, uint64_t *poff)
 	kernel_assert(holdingsleep(&dp->lock));
 	uint64_t off, inum;
 	struct dirent de;
+	struct dirindex *di;
 
 	if (!S_ISDIR(dp->mode))
 		panic("dirlookup not DIR");
 
+	if ((di = dirindex_get(dp)) != NULL) {
+		uint32_t hash = dirhash(name);
+		uint32_t i = hash & (di->nslots - 1);
+		struct dirslot *s;
+
+		while ((s = dirindex_slot(di, i))->ent != DIRSLOT_EMPTY) {
+			if (s->ent != DIRSLOT_DELETED && s->hash == hash) {
+				off = (uint64_t)(s->ent - 1) * sizeof(de);
+				if (inode_read(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
+					panic("dirlookup read");
+				if (de.d_ino != 0 && namecmp(name, de.d_name) == 0)
+					goto found;
+			}
+			i = (i + 1) & (di->nslots - 1);
+		}
+		return 0;
+	}
+
 	for (off = 0; off < dp->size; off += sizeof(de)) {
 		if (inode_read(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
 			panic("dirlookup read");
 		if (de.d_ino == 0)
 			continue;
-		if (namecmp(name, de.d_name) == 0) {
-			// entry matches path element
-			if (poff)
-				*poff = off;
-			inum = de.d_ino;
-			return inode_get(dp->dev, inum);
-		}
+		if (namecmp(name, de.d_name) == 0)
+			goto found;
 	}
 
 	return 0;
+
+found:
+	// entry matches path element
+	if (poff)
+		*poff = off;
+	inum = de.d_ino;
+	return inode_get(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
-static uint32_t last_inum = 0;
-static uint64_t last_offset_from_inum = 0;
 int
 dirlink(struct inode *dp, const char *name, uint32_t inum)
 {
 	uint64_t off = 0;
 	struct dirent de;
 	struct inode *ip;
+	struct dirindex *di;
 
 	// Check that name is not present.
 	if ((ip = dirlookup(dp, name, 0)) != 0) {
 		inode_put(ip);
 		return -1;
 	}
-	if (inum == last_inum) {
-		if (last_offset_from_inum + sizeof(de) < dp->size) {
-			off = last_offset_from_inum + sizeof(de);
-		} else {
-			off = 0;
-		}
-	}
+	if ((di = dp->dindex) != NULL)
+		off = (uint64_t)di->firstfree * sizeof(de);
 	// Look for an empty dirent.
 	for (; off < dp->size; off += sizeof(de)) {
 		if (inode_read(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
 			panic("dirlink read");
-		if (de.d_ino == 0) {
-			last_offset_from_inum = off;
+		if (de.d_ino == 0)
 			break;
-		}
 	}
 
 	strncpy(de.d_name, name, DIRSIZ);
 	de.d_ino = inum;
 	if (inode_write(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
 		panic("dirlink");
-	last_inum = inum;
+	dcache_enter(dp->dev, dp->inum, name, inum);
+
+	if (di != NULL) {
+		di->firstfree = off / sizeof(de) + 1;
+		// Keep at least a quarter of the slots empty,
+		// so that probes for missing names stay short.
+		if ((di->nused + 1) * 4 > di->nslots * 3) {
+			dirindex_drop(dp);
+			dirindex_get(dp);
+		} else
+			dirindex_insert(di, dirhash(name), off / sizeof(de));
+	}
 
 	return 0;
 }
 
+// Clear the directory entry at off in dp.
+void
+dirunlink(struct inode *dp, uint64_t off)
+{
+	struct dirent de;
+	struct dirindex *di;
+	uint32_t ent = off / sizeof(de);
+
+	if (inode_read(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
+		panic("dirunlink read");
+	if ((di = dp->dindex) != NULL) {
+		dirindex_remove(di, dirhash(de.d_name), ent);
+		di->firstfree = min(di->firstfree, ent);
+	}
+	dcache_enter(dp->dev, dp->inum, de.d_name, 0);
+	memset(&de, 0, sizeof(de));
+	if (inode_write(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
+		panic("dirunlink");
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -765,6 +1175,7 @@ static struct inode *
 namex(const char *path, int nameiparent, char *name)
 {
 	struct inode *ip, *next;
+	uint32_t inum, again;
 
 	if (*path == '/')
 		ip = inode_get(ROOTDEV, ROOTINO);
@@ -772,6 +1183,23 @@ namex(const char *path, int nameiparent, char *name)
 		ip = inode_dup(myproc()->cwd); // increase refcount
 
 	while ((path = skipelem(path, name)) != 0) {
+		// Ask the name cache first, without locking ip. The
+		// entry is checked again once the inode is referenced,
+		// since it could have been unlinked in between.
+		if (!(nameiparent && *path == '\0') &&
+				dcache_lookup(ip->dev, ip->inum, name, &inum)) {
+			if (inum == 0) {
+				inode_put(ip);
+				return 0;
+			}
+			next = inode_get(ip->dev, inum);
+			if (dcache_find(ip->dev, ip->inum, name, &again) && again == inum) {
+				inode_put(ip);
+				ip = next;
+				continue;
+			}
+			inode_put(next);
+		}
 		inode_lock(ip);
 		if (!S_ISDIR(ip->mode)) {
 			inode_unlockput(ip);
@@ -782,7 +1210,9 @@ namex(const char *path, int nameiparent, char *name)
 			inode_unlock(ip);
 			return ip;
 		}
-		if ((next = dirlookup(ip, name, 0)) == 0) {
+		next = dirlookup(ip, name, 0);
+		dcache_enter(ip->dev, ip->inum, name, next ? next->inum : 0);
+		if (next == 0) {
 			inode_unlockput(ip);
 			return 0;
 		}
@@ -1,4 +1,5 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE driver code. Transfers use bus master DMA when the
+// controller supports it (PIIX and friends), PIO otherwise.
 
 #include "param.h"
 #include "proc.h"
@@ -8,9 +9,16 @@
 #include "spinlock.h"
 #include "fs.h"
 #include "buf.h"
+#include "bio.h"
 #include "ioapic.h"
+#include "ioctl.h"
 #include "console.h"
 #include "compiler_attributes.h"
+#include "kalloc.h"
+#include "macros.h"
+#include "pci.h"
+#include "drivers/mmu.h"
+#include "drivers/memlayout.h"
 
 #define SECTOR_SIZE 512
 #define IDE_BSY 0x80
@@ -22,17 +30,60 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_READ_DMA 0xc8
+#define IDE_CMD_WRITE_DMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
+// Sectors per DRQ block for READ/WRITE MULTIPLE. A PIO
+// request never transfers more than one DRQ block.
+#define IDE_MULT_SECTORS 16
+
+// Bus master IDE registers of the primary channel,
+// relative to the I/O base in BAR4.
+#define BMIDE_CMD 0
+#define BMIDE_STATUS 2
+#define BMIDE_PRDT 4
+#define BMIDE_CMD_START 0x01
+#define BMIDE_CMD_READ 0x08 // device to memory
+#define BMIDE_STATUS_ERR 0x02
+#define BMIDE_STATUS_IRQ 0x04
+
+// Physical region descriptor: one physically contiguous
+// piece of a transfer. A region may not cross 64 KiB.
+struct prd {
+	uint32_t addr;
+	uint16_t len;
+	uint16_t flags;
+};
+#define PRD_EOT 0x8000 // last entry of the table
+#define NPRD 64
+
+// Most blocks merged into a single DMA command. Each block
+// may straddle a page, and so take two descriptors.
+#define IDE_DMA_MAXBLOCKS (NPRD / 2)
+
+// idequeue points to the bufs now being read/written to the disk:
+// the first nactive of them were merged into the command in flight.
+// The rest are sorted in C-LOOK order: ascending from headpos,
+// then wrapping around to the lowest block.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static int nactive;
+static uint64_t headpos;
+static struct ide_stats stats;
 
 static int havedisk1;
+static int pio_maxblocks = 1;
 static void
-idestart(struct buf *);
+idestart(void);
+
+static uint16_t bmide; // bus master base port, 0 if there is none
+static int usedma;
+static int curdma; // whether the command in flight uses DMA
+// The table must not cross a 64 KiB boundary either.
+static struct prd prdt[NPRD] __attribute__((aligned(sizeof(struct prd) * NPRD)));
 
 // Wait for IDE disk to become ready.
 static int
@@ -47,12 +98,58 @@ idewait(int checkerr)
 	return 0;
 }
 
+// Find a bus master capable IDE controller among the
+// devices pci_init() enumerated and enable it.
+static __cold void
+ide_dma_probe(void)
+{
+	struct FatPointerArray_pci_conf confs = pci_get_conf();
+	struct pci_conf *c;
+	uint32_t bar4, cmd;
+
+	for (c = confs.ptr; c < confs.ptr + confs.len; c++) {
+		if (c->base_class != PCI_CLASS_STORAGE ||
+				c->subclass != PCI_SUBCLASS_IDE || !(c->prog_if & 0x80))
+			continue;
+		bar4 = pci_config_read32(c->bus, c->device, c->function, PCI_CONF_BAR4);
+		// Bus master registers live in I/O space.
+		if (!(bar4 & 1) || (bar4 & ~3) == 0)
+			continue;
+		cmd = pci_config_read32(c->bus, c->device, c->function, PCI_CONF_COMMAND);
+		pci_config_write16(c->bus, c->device, c->function, PCI_CONF_COMMAND,
+											 (cmd & 0xffff) | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+		bmide = bar4 & ~3;
+		break;
+	}
+	// An empty Vec hands back a dangling pointer, not one from kmalloc.
+	if (confs.len != 0)
+		kfree(confs.ptr);
+}
+
+// Ask disk dev for IDE_MULT_SECTORS sectors per DRQ block.
+// Interrupts are masked, since nothing is queued to take them.
+static __cold int
+ide_setmultiple(int dev)
+{
+	idewait(0);
+	outb(0x3f6, 2);
+	outb(0x1f2, IDE_MULT_SECTORS);
+	outb(0x1f6, 0xe0 | ((dev & 1) << 4));
+	outb(0x1f7, IDE_CMD_SETMUL);
+	return idewait(1);
+}
+
 __cold void
 ideinit(void)
 {
 	int i;
 
 	initlock(&idelock, "ide");
+	ide_dma_probe();
+	if (bmide != 0) {
+		usedma = 1;
+		cprintf("ide: bus master DMA at port %#x\n", bmide);
+	}
 	ioapicenable(IRQ_IDE, ncpu - 1);
 	idewait(0);
 
@@ -65,33 +162,162 @@ ideinit(void)
 		}
 	}
 
+	// PIO requests can only be merged up to one DRQ block.
+	if (ide_setmultiple(0) == 0 && (!havedisk1 || ide_setmultiple(1) == 0))
+		pio_maxblocks = IDE_MULT_SECTORS / (BSIZE / SECTOR_SIZE);
+
 	// Switch back to disk 0.
 	outb(0x1f6, 0xe0 | (0 << 4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Turn DMA on or off for later requests.
+// Returns -1 if there is no controller to do DMA with.
+int
+ide_set_dma(int on)
+{
+	if (on && bmide == 0)
+		return -1;
+	acquire(&idelock);
+	usedma = on != 0;
+	release(&idelock);
+	return 0;
+}
+
+int
+ide_using_dma(void)
+{
+	return usedma;
+}
+
+void
+ide_get_stats(struct ide_stats *st)
+{
+	acquire(&idelock);
+	*st = stats;
+	release(&idelock);
+}
+
+// Describe the data of the first n bufs in the queue to the
+// controller, one entry for each physical page they touch.
+// Caller must hold idelock.
+static void
+ide_prd_fill(int n)
+{
+	struct buf *b;
+	uintptr_t pa, end, len;
+	int i = 0;
+
+	for (b = idequeue; n > 0; b = b->qnext, n--) {
+		pa = V2P(b->data);
+		end = pa + BSIZE;
+		for (; pa < end; i++) {
+			if (i == NPRD)
+				panic("ide_prd_fill");
+			len = min(end, PGROUNDUP(pa + 1)) - pa;
+			prdt[i].addr = pa;
+			prdt[i].len = len;
+			prdt[i].flags = 0;
+			pa += len;
+		}
+	}
+	prdt[i - 1].flags = PRD_EOT;
+}
+
+// Position of b on the disks, for sorting.
+static inline uint64_t
+ide_pos(struct buf *b)
+{
+	return ((uint64_t)b->dev << 32) | b->blockno;
+}
+
+// Does a go before b in C-LOOK order?
+static int
+ide_before(struct buf *a, struct buf *b)
+{
+	int aahead = ide_pos(a) >= headpos;
+	int bahead = ide_pos(b) >= headpos;
+
+	if (aahead != bahead)
+		return aahead;
+	return ide_pos(a) < ide_pos(b);
+}
+
+// Insert b in the queue, behind the command in flight.
+// Caller must hold idelock.
+static void
+ide_enqueue(struct buf *b)
+{
+	struct buf **pp;
+	int i;
+
+	pp = &idequeue;
+	for (i = 0; i < nactive; i++)
+		pp = &(*pp)->qnext;
+	for (; *pp; pp = &(*pp)->qnext)
+		if (ide_before(b, *pp))
+			break;
+	b->qnext = *pp;
+	*pp = b;
+
+	b->qstart = rdtsc();
+	stats.requests++;
+	if (++stats.depth > stats.maxdepth)
+		stats.maxdepth = stats.depth;
+}
+
+// Start a command for the head of the queue, merging as many of
+// the bufs after it as continue it on disk in the same direction.
+// Caller must hold idelock.
 static void
-idestart(struct buf *b)
+idestart(void)
 {
+	struct buf *b = idequeue, *next;
+	int n, maxblocks;
+
 	if (unlikely(b == 0))
 		panic("idestart");
 	if (b->blockno >= FSSIZE)
 		panic("incorrect blockno");
+
+	curdma = usedma;
+	maxblocks = curdma ? IDE_DMA_MAXBLOCKS : pio_maxblocks;
+	for (n = 1, next = b->qnext; n < maxblocks && next != 0; n++, next = next->qnext) {
+		if (ide_pos(next) != ide_pos(b) + n ||
+				(next->flags & B_DIRTY) != (b->flags & B_DIRTY))
+			break;
+	}
+	nactive = n;
+	headpos = ide_pos(b) + n;
+	stats.commands++;
+	stats.merged += n - 1;
+
 	const int sector_per_block = BSIZE / SECTOR_SIZE;
 	int sector = b->blockno * sector_per_block;
-	int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ : IDE_CMD_RDMUL;
-	int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+	int nsector = n * sector_per_block;
+	int read_cmd = (nsector == 1) ? IDE_CMD_READ : IDE_CMD_RDMUL;
+	int write_cmd = (nsector == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
 	idewait(0);
+	if (curdma) {
+		ide_prd_fill(n);
+		outl(bmide + BMIDE_PRDT, V2P(prdt));
+		outb(bmide + BMIDE_CMD, (b->flags & B_DIRTY) ? 0 : BMIDE_CMD_READ);
+		// Both status bits are cleared by writing 1.
+		outb(bmide + BMIDE_STATUS, BMIDE_STATUS_ERR | BMIDE_STATUS_IRQ);
+	}
 	outb(0x3f6, 0); // generate interrupt
-	outb(0x1f2, sector_per_block); // number of sectors
+	outb(0x1f2, nsector); // number of sectors
 	outb(0x1f3, sector & 0xff);
 	outb(0x1f4, (sector >> 8) & 0xff);
 	outb(0x1f5, (sector >> 16) & 0xff);
 	outb(0x1f6, 0xe0 | ((b->dev & 1) << 4) | ((sector >> 24) & 0x0f));
-	if (b->flags & B_DIRTY) {
+	if (curdma) {
+		outb(0x1f7, (b->flags & B_DIRTY) ? IDE_CMD_WRITE_DMA : IDE_CMD_READ_DMA);
+		outb(bmide + BMIDE_CMD, inb(bmide + BMIDE_CMD) | BMIDE_CMD_START);
+	} else if (b->flags & B_DIRTY) {
 		outb(0x1f7, write_cmd);
-		outsl(0x1f0, b->data, BSIZE / 4);
+		for (; n > 0; b = b->qnext, n--)
+			outsl(0x1f0, b->data, BSIZE / 4);
 	} else {
 		outb(0x1f7, read_cmd);
 	}
@@ -102,63 +328,125 @@ void
 ideintr(void)
 {
 	struct buf *b;
+	uint64_t now, lat;
+	int n;
 
-	// First queued buffer is the active request.
+	// First queued buffers are the active request.
 	acquire(&idelock);
 
 	if ((b = idequeue) == 0) {
 		release(&idelock);
 		return;
 	}
-	idequeue = b->qnext;
 
-	// Read data if needed.
-	if (!(b->flags & B_DIRTY) && idewait(1) >= 0)
-		insl(0x1f0, b->data, BSIZE / 4);
+	if (curdma) {
+		uint8_t status = inb(bmide + BMIDE_STATUS);
+		outb(bmide + BMIDE_CMD, 0);
+		outb(bmide + BMIDE_STATUS, BMIDE_STATUS_ERR | BMIDE_STATUS_IRQ);
+		if ((status & BMIDE_STATUS_ERR) || idewait(1) < 0) {
+			// Give up on DMA and redo the request with PIO.
+			cprintf("ide: DMA error, status %#x; falling back to PIO\n", status);
+			usedma = 0;
+			idestart();
+			release(&idelock);
+			return;
+		}
+	} else if (!(b->flags & B_DIRTY) && idewait(1) >= 0) {
+		// Read data if needed.
+		for (n = 0; n < nactive; n++, b = b->qnext)
+			insl(0x1f0, b->data, BSIZE / 4);
+	}
+
+	now = rdtsc();
+	for (n = 0; n < nactive; n++) {
+		b = idequeue;
+		idequeue = b->qnext;
+
+		lat = now - b->qstart;
+		stats.latency += lat;
+		if (lat > stats.maxlatency)
+			stats.maxlatency = lat;
+		stats.depth--;
 
-	// Wake process waiting for this buf.
-	b->flags |= B_VALID;
-	b->flags &= ~B_DIRTY;
-	wakeup(b);
+		// Wake process waiting for this buf.
+		b->flags |= B_VALID;
+		b->flags &= ~B_DIRTY;
+		if (b->flags & B_ASYNC)
+			block_async_done(b);
+		else
+			wakeup(b);
+	}
+	nactive = 0;
 
 	// Start disk on next buf in queue.
 	if (idequeue != 0)
-		idestart(idequeue);
+		idestart();
 
 	release(&idelock);
 }
 
-// Sync buf with disk.
+// Queue the n bufs in bufs and start the disk if it is idle.
+// Caller must hold idelock.
+static void
+ide_submit(struct buf **bufs, int n)
+{
+	struct buf *b;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		b = bufs[i];
+		if (!holdingsleep(&b->lock))
+			panic("iderw: buf not locked");
+		if ((b->flags & (B_VALID | B_DIRTY)) == B_VALID)
+			panic("iderw: nothing to do");
+		if (b->dev != 0 && !havedisk1)
+			panic("iderw: ide disk 1 not present");
+	}
+
+	for (i = 0; i < n; i++)
+		ide_enqueue(bufs[i]);
+
+	// Start disk if necessary.
+	if (nactive == 0)
+		idestart();
+}
+
+// Sync the n bufs in bufs with disk, letting the queue sort and
+// merge them. Each must be locked by the caller.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
 void
-iderw(struct buf *b)
+iderw_batch(struct buf **bufs, int n)
 {
-	struct buf **pp;
-
-	if (!holdingsleep(&b->lock))
-		panic("iderw: buf not locked");
-	if ((b->flags & (B_VALID | B_DIRTY)) == B_VALID)
-		panic("iderw: nothing to do");
-	if (b->dev != 0 && !havedisk1)
-		panic("iderw: ide disk 1 not present");
+	struct buf *b;
+	int i;
 
 	acquire(&idelock); //DOC:acquire-lock
 
-	// Append b to idequeue.
-	b->qnext = 0;
-	for (pp = &idequeue; *pp; pp = &(*pp)->qnext) //DOC:insert-queue
-		;
-	*pp = b;
+	ide_submit(bufs, n);
 
-	// Start disk if necessary.
-	if (idequeue == b)
-		idestart(b);
-
-	// Wait for request to finish.
-	while ((b->flags & (B_VALID | B_DIRTY)) != B_VALID) {
-		sleep(b, &idelock);
+	// Wait for requests to finish.
+	for (i = 0; i < n; i++) {
+		b = bufs[i];
+		while ((b->flags & (B_VALID | B_DIRTY)) != B_VALID)
+			sleep(b, &idelock);
 	}
 
 	release(&idelock);
 }
+
+void
+iderw(struct buf *b)
+{
+	iderw_batch(&b, 1);
+}
+
+// Like iderw_batch(), but return at once. The bufs must have
+// B_ASYNC set; the driver releases each one when it is done.
+void
+iderw_async(struct buf **bufs, int n)
+{
+	acquire(&idelock);
+	ide_submit(bufs, n);
+	release(&idelock);
+}
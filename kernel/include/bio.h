@@ -5,7 +5,18 @@ void
 block_init(void);
 struct buf *
 block_read(uint32_t, uint32_t);
+struct buf *
+block_get_zero(uint32_t, uint32_t);
 void
 block_release(struct buf *);
 void
 block_write(struct buf *);
+void
+block_write_batch(struct buf **, int);
+void
+block_prefetch(uint32_t, uint32_t *, int);
+void
+block_async_done(struct buf *);
+struct bio_stats;
+void
+block_get_stats(struct bio_stats *);
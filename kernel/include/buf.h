@@ -8,10 +8,15 @@ struct buf {
 	uint32_t blockno;
 	struct sleeplock lock;
 	uint32_t refcnt;
-	struct buf *prev; // LRU cache list
+	struct buf *prev; // hash bucket list
 	struct buf *next;
+	int bucket; // hash bucket b is on, or -1 if none
+	uint8_t used; // referenced since the clock hand passed
 	struct buf *qnext; // disk queue
-	uint8_t data[BSIZE];
+	uint64_t qstart; // TSC when queued, for latency stats
+	uint8_t *data; // BSIZE bytes, half of a page frame
 };
 #define B_VALID 0x2 // buffer has been read from disk
 #define B_DIRTY 0x4 // buffer needs to be written to disk
+#define B_ASYNC 0x8 // the disk driver releases the buffer when done
+#define B_READAHEAD 0x10 // read ahead and not used since
@@ -0,0 +1,23 @@
+#pragma once
+#include <stdint.h>
+
+#define DCACHE_NAMELEN 32 // longest cached name, with its NUL
+
+struct fsstat;
+
+void
+dcache_init(void);
+int
+dcache_lookup(uint32_t dev, uint32_t parent, const char *name, uint32_t *inum);
+int
+dcache_find(uint32_t dev, uint32_t parent, const char *name, uint32_t *inum);
+void
+dcache_enter(uint32_t dev, uint32_t parent, const char *name, uint32_t inum);
+void
+dcache_remove(uint32_t dev, uint32_t parent, const char *name);
+void
+dcache_purge(uint32_t dev, uint32_t inum);
+uint32_t
+dcache_reverse(uint32_t dev, uint32_t inum, char *name);
+void
+dcache_get_stats(struct fsstat *);
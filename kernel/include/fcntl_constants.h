@@ -5,6 +5,8 @@
 #define O_CREATE 0x200
 #define O_APPEND 0x400
 #define O_NONBLOCK 0x800
+#define O_SYNC 0x1000 // write() returns once the data is committed
+#define O_DSYNC 0x2000 // the same; the log does not split data and metadata
 
 // These three pretty much wrap dup().
 #define F_DUPFD 0x000
@@ -8,9 +8,16 @@ struct file {
 	int ref; // reference count
 	char readable;
 	char writable;
+	char sync; // O_SYNC: commit before write() returns
 	struct pipe *pipe;
 	struct inode *ip;
 	uint32_t off;
+	// Sequential read detection: where the next read starts if
+	// the file is being streamed, how many blocks to read ahead,
+	// and the block after the last one read ahead.
+	uint32_t ra_next;
+	uint32_t ra_window;
+	uint32_t ra_end;
 };
 
 // table mapping major device number to
@@ -45,5 +52,14 @@ int
 fileseek(struct file *f, int n, int whence);
 struct file *
 fd_to_struct_file(int fd);
+int
+fd_alloc(struct file *f);
+void
+fd_clear(int fd);
+struct proc;
+int
+fd_copy(struct proc *np);
+void
+fd_closeall(void);
 char *
 inode_to_path(char *buf, size_t n, struct inode *ip);
@@ -42,8 +42,11 @@ struct superblock {
 // in-memory copy of an inode
 struct inode {
 	uint32_t dev; // Device number
-	uint32_t inum; // Inode number
+	uint32_t inum; // Inode number, or 0 if the entry is free
 	int ref; // Reference count
+	struct inode *hnext; // hash chain
+	struct inode *lru_prev; // unreferenced inodes, least recent last
+	struct inode *lru_next;
 	struct sleeplock lock; // protects everything below here
 	int valid; // inode has been read from disk?
 
@@ -58,6 +61,8 @@ struct inode {
 	short major; // Major device number (T_DEV only)
 	short minor; // Minor device number (T_DEV only)
 	short nlink; // Number of links to inode in file system
+	uint64_t logseq; // last log transaction that changed it
+	struct dirindex *dindex; // name index of a big directory, or 0
 	/* 2 bytes of padding */
 };
 // On-disk inode structure
@@ -97,15 +102,24 @@ void
 read_superblock(int dev, struct superblock *sb);
 int
 dirlink(struct inode *, const char *, uint32_t);
+void
+dirunlink(struct inode *, uint64_t);
 struct inode *
 dirlookup(struct inode *, const char *, uint64_t *);
 struct inode *
 inode_alloc(uint32_t, int32_t);
 struct inode *
 inode_dup(struct inode *);
+struct inode *
+inode_get(uint32_t dev, uint32_t inum);
 void
 inode_init(int dev);
 void
+block_index_init(uint32_t dev);
+struct fsstat;
+void
+balloc_get_stats(uint32_t dev, struct fsstat *);
+void
 inode_lock(struct inode *);
 void
 inode_put(struct inode *);
@@ -124,6 +138,8 @@ nameiparent(const char *, char *);
 int
 inode_read(struct inode *, char *, uint64_t, uint64_t);
 void
+inode_readahead(struct inode *, uint32_t, uint32_t);
+void
 inode_stat(struct inode *, struct stat *);
 int
 inode_write(struct inode *, char *, uint64_t, uint64_t);
@@ -1,5 +1,6 @@
 #pragma once
 #include <buf.h>
+#include "ioctl.h"
 
 void
 ideinit(void);
@@ -7,3 +8,13 @@ void
 ideintr(void);
 void
 iderw(struct buf *);
+void
+iderw_batch(struct buf **, int);
+void
+iderw_async(struct buf **, int);
+int
+ide_set_dma(int on);
+int
+ide_using_dma(void);
+void
+ide_get_stats(struct ide_stats *);
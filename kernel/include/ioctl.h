@@ -10,3 +10,127 @@
 // In the future, this constant may change.
 #define _IOC(drv_magic, rw, size, number) ((drv_magic << 24) | (number << 16) | (size << 2) | rw)
 #define PCIIOCGETCONF _IOC('P', _IOC_RW, sizeof(struct pci_conf), 0)
+// Counters kept by the IDE request queue.
+struct ide_stats {
+	uint64_t requests; // blocks read or written
+	uint64_t commands; // commands issued to the disk
+	uint64_t merged; // blocks that rode along in another block's command
+	uint32_t depth; // blocks queued now, including those in flight
+	uint32_t maxdepth;
+	uint64_t latency; // sum over blocks of TSC cycles from queueing to completion
+	uint64_t maxlatency;
+};
+
+// Counters kept by the buffer cache.
+struct bio_stats {
+	uint32_t nbuf; // buffers in the cache
+	uint64_t hits; // block reads served from the cache
+	uint64_t misses; // ... and from the disk
+	uint64_t evictions; // cached blocks dropped to make room
+	uint64_t acquires; // hash bucket locks taken
+	uint64_t contended; // ... that were already held
+	uint64_t ra_issued; // blocks read ahead
+	uint64_t ra_hits; // ... and later read from the cache
+	uint64_t ra_wasted; // ... and evicted without being read
+};
+
+// Usage of one slab cache.
+struct slab_stats {
+	char name[16]; // empty if there is no such cache
+	uint32_t size; // bytes per object
+	uint32_t pages; // page frames holding its slabs
+	uint32_t objects; // objects those pages hold
+	uint32_t inuse; // ... that are allocated
+	uint64_t allocs;
+	uint64_t frees;
+};
+#define NSLABSTATS 24
+
+// What one CPU did in the page allocator.
+struct mem_cpu_stats {
+	uint64_t allocs; // single pages allocated
+	uint64_t frees; // ... and freed
+	uint64_t refills; // batches taken from the buddy allocator
+	uint64_t drains; // ... and given back
+	uint64_t steals; // pages taken from other CPUs' lists
+	uint64_t acquires; // allocator locks taken
+	uint64_t contended; // ... that another CPU held
+};
+#define MEMSTATS_NCPU 16
+
+// Free physical memory.
+struct mem_stats {
+	uint64_t pages; // page frames below the top of memory
+	uint64_t cached; // free pages on the CPUs' lists
+	uint64_t nfree[11]; // free blocks of 2^i pages in the buddy allocator
+	uint64_t zeroed; // free pages zeroed ahead of time
+	uint64_t zero_hits; // zeroed pages wanted and ready
+	uint64_t zero_misses; // ... and zeroed on the spot
+	uint64_t zero_filled; // pages idle CPUs zeroed
+	uint32_t ncpu; // entries of cpu[] filled in
+	struct mem_cpu_stats cpu[MEMSTATS_NCPU];
+};
+
+// What one CPU's scheduler did.
+struct sched_cpu_stats {
+	uint64_t switches; // processes switched to
+	uint64_t steals; // ... taken from other CPUs' queues
+	uint64_t idle; // times there was nothing to run
+	uint64_t halts; // ... and it halted with its timer stopped
+	uint64_t kicks; // IPIs sent to wake idle CPUs
+	uint64_t preempts; // processes made to give up the CPU
+	uint64_t wakeups; // calls to wakeup()
+	uint64_t woken; // ... processes they woke
+	uint64_t wait_scanned; // ... sleepers they looked at
+	uint64_t acquires; // run queue locks taken
+	uint64_t contended; // ... that another CPU held
+	uint64_t nrunnable; // processes waiting on the queue now
+};
+#define SCHEDSTATS_NCPU 128 // NCPU in kernel/include/param.h
+
+struct sched_stats {
+	uint32_t ncpu; // entries of cpu[] filled in
+	struct sched_cpu_stats cpu[SCHEDSTATS_NCPU];
+};
+
+// One process, as ps shows it.
+struct proc_stats {
+	int32_t pid; // 0 past the last process
+	int32_t ppid;
+	int32_t state; // enum procstate
+	int32_t nice;
+	int32_t cpu; // that it last ran on
+	char name[16];
+	uint64_t runtime; // cycles spent running
+	uint64_t switches; // times it was given the CPU
+};
+#define NPROCSTATS 64 // NPROC in kernel/include/param.h
+
+// The timing wheel that sleeping processes wait on.
+struct timer_stats {
+	uint64_t ticks; // clock ticks so far
+	uint64_t sleeps; // calls to sleep_until()
+	uint64_t spurious; // sleepers woken before their deadline
+	uint64_t expired; // timeouts that woke their sleeper
+	uint64_t cascaded; // timeouts moved down a level of the wheel
+	uint64_t pending; // timeouts armed now
+};
+
+// Turn IDE bus master DMA on (arg 1) or off (arg 0). Root only.
+#define IDEIOCSDMA _IOC('I', _IOC_WO, sizeof(int), 0)
+// Store whether IDE bus master DMA is in use in *(int *)arg.
+#define IDEIOCGDMA _IOC('I', _IOC_RO, sizeof(int), 1)
+// Copy the IDE queue counters to *(struct ide_stats *)arg.
+#define IDEIOCGSTATS _IOC('I', _IOC_RO, sizeof(struct ide_stats), 2)
+// Copy the buffer cache counters to *(struct bio_stats *)arg.
+#define BIOIOCGSTATS _IOC('B', _IOC_RO, sizeof(struct bio_stats), 0)
+// Copy the usage of every slab cache to *(struct slab_stats (*)[NSLABSTATS])arg.
+#define SLABIOCGSTATS _IOC('S', _IOC_RO, sizeof(struct slab_stats[NSLABSTATS]), 0)
+// Copy the physical memory counters to *(struct mem_stats *)arg.
+#define MEMIOCGSTATS _IOC('M', _IOC_RO, sizeof(struct mem_stats), 0)
+// Copy the scheduler counters to *(struct sched_stats *)arg.
+#define SCHEDIOCGSTATS _IOC('R', _IOC_RO, sizeof(struct sched_stats), 0)
+// Copy a description of every process to *(struct proc_stats (*)[NPROCSTATS])arg.
+#define PROCIOCGSTATS _IOC('R', _IOC_RO, sizeof(struct proc_stats[NPROCSTATS]), 1)
+// Copy the timing wheel counters to *(struct timer_stats *)arg.
+#define TIMERIOCGSTATS _IOC('T', _IOC_RO, sizeof(struct timer_stats), 0)
@@ -1,15 +1,38 @@
 #pragma once
 #include <stddef.h>
 #include "compiler_attributes.h"
+
+#define KPAGE_NORDER 11 // blocks of 1 to 1024 pages
+
+struct mem_stats;
+
 char *
 kpage_alloc(void);
+char *
+kpage_alloc_zeroed(void);
+int
+kpage_zero_idle(void);
+char *
+kpages_alloc(int order);
+int
+kpages_order(size_t n);
+size_t
+kpages_free(void);
+__nonnull(1) void kpages_split(char *);
+__nonnull(1) void kpages_ref(char *, int order);
+__nonnull(1) void kpages_put(char *, int order);
+__nonnull(1) int kpage_order(char *);
 __nonnull(1) void kpage_free(char *);
+__nonnull(1) void kpage_ref(char *);
+__nonnull(1) int kpage_refcount(char *);
 __attribute__((malloc)) __nonnull(1) void *kpage_realloc(char *ptr,
 																												 size_t size);
 
 __attribute__((malloc)) void *
 kmalloc(size_t size);
-__nonnull(1) __attribute__((malloc)) void *krealloc(void *ptr, size_t size);
+__attribute__((malloc)) void *
+kmalloc_align(size_t size, size_t align);
+__nonnull(1) void *krealloc(void *ptr, size_t size);
 __attribute__((malloc)) void *
 kcalloc(size_t size);
 
@@ -19,3 +42,5 @@ void
 kinit1(void *, void *);
 void
 kinit2(void *, void *);
+void
+kmem_get_stats(struct mem_stats *st);
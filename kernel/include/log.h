@@ -1,5 +1,6 @@
 #pragma once
 #include <buf.h>
+struct inode;
 void
 initlog(int dev);
 void
@@ -8,3 +9,11 @@ void
 begin_op(void);
 void
 end_op(void);
+void
+log_sync(void);
+void
+log_mark(struct inode *);
+uint64_t
+log_seq(void);
+void
+log_force(uint64_t);
@@ -1,17 +1,23 @@
 #pragma once
 #define NPROC 64 // maximum number of processes
+#define HZ 1000 // timer interrupts per second
+#define TICK_NSEC (1000000000 / HZ) // nanoseconds per tick
 #define KSTACKSIZE 4096 // size of per-process kernel stack
 #define NCPU 128 // maximum number of CPUs
-#define NOFILE 16 // open files per process
-#define NFILE 100 // open files per system
+#define NOFILE 16 // initial size of a process's fd table
+#define NOFILE_MAX 1024 // open files per process
 #define NLINK_DEREF 31 // max amount of symlink dereferences
-#define NINODE 50 // maximum number of active i-nodes
+#define NINODE 50 // minimum size of the inode cache
+#define NINODE_MAX 4096 // maximum size of the inode cache
+#define INODE_MEMSHARE 256 // inode cache gets 1/INODE_MEMSHARE of memory
 #define NDEV 10 // maximum major device number
 #define ROOTDEV 1 // device number of file system root disk
 #define MAXARG 32 // max exec arguments
 #define MAXOPBLOCKS 10 // max # of blocks any FS op writes
-#define LOGSIZE (MAXOPBLOCKS * 3) // max data blocks in on-disk log
-#define NBUF (MAXOPBLOCKS * 3) // size of disk block cache
+#define LOGSIZE (MAXOPBLOCKS * 12) // blocks in the on-disk log made by mkfs
+#define NBUF (MAXOPBLOCKS * 3) // minimum size of disk block cache
+#define NBUF_MAX 4096 // maximum size of disk block cache
+#define BUF_MEMSHARE 64 // block cache gets 1/BUF_MEMSHARE of memory
 #define FSSIZE (10 * 1024) // size of file system in blocks
 #define MAXGROUPS 32 // maximum groups there can be
 #define MAX_USERNAME 256
@@ -19,3 +25,6 @@
 #define MAXENV 32
 #define MAX_PCI_DEVICES 32
 #define NMMAP 10 // maximum number of mmap()'s allowed per process'
+#define RA_MAXBLOCKS 8 // largest read-ahead window, in blocks
+#define HEAP_RESERVE 1024 // pages sbrk() leaves free for the kernel
+#define NVMAREA 8 // maximum number of lazily loaded regions per process
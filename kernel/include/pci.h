@@ -36,4 +36,16 @@ extern void
 pci_init(void);
 extern struct FatPointerArray_pci_conf
 pci_get_conf(void);
+extern uint32_t
+pci_config_read32(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset);
+extern void
+pci_config_write16(uint8_t bus, uint8_t device, uint8_t function,
+									 uint8_t offset, uint16_t value);
+
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+#define PCI_CONF_COMMAND 0x04
+#define PCI_CONF_BAR4 0x20
+#define PCI_COMMAND_IO 0x1
+#define PCI_COMMAND_MASTER 0x4
 #endif
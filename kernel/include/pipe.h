@@ -1,6 +1,8 @@
 #pragma once
 #include <file.h>
 
+void
+pipeinit(void);
 int
 pipealloc(struct file **, struct file **);
 void
@@ -6,6 +6,7 @@
 #include "param.h"
 #include "spinlock.h"
 #include "syscall.h"
+#include "timeout.h"
 #include "types.h"
 #include <stdint.h>
 #include "../drivers/mmu.h"
@@ -77,6 +78,17 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A range of user memory whose pages are filled on first touch:
+// the first filesz bytes come from ip at offset off, the rest is zero.
+struct vmarea {
+	uintptr_t start; // page aligned
+	uintptr_t end;
+	struct inode *ip;
+	uint64_t off;
+	uint64_t filesz;
+	int perm;
+};
+
 // Per-process state
 struct proc {
 	uintptr_t sz; // Size of process memory (bytes)
@@ -89,8 +101,19 @@ struct proc {
 	struct trapframe *tf; // Trap frame for current syscall
 	struct context *context; // swtch() here to run process
 	void *chan; // If non-zero, sleeping on chan
+	struct proc *wq_next, *wq_prev; // On chan's wait queue
+	int cpu; // CPU whose run queue holds us, or that we last ran on
+	struct proc *rq_next, *rq_prev; // On that run queue
+	int nice; // NICE_MIN gets the most CPU time, NICE_MAX the least
+	uint64_t runtime; // Cycles spent running
+	uint64_t vruntime; // runtime scaled by weight, for fairness
+	uint64_t lastrun; // rdtsc() when last charged for running
+	uint64_t nswitch; // Times it was given the CPU
+	struct timeout timeout; // Ends sleep_until()
 	int killed; // If non-zero, have been killed
-	struct file *ofile[NOFILE]; // Open files
+	struct file **ofile; // Open files, nofile slots
+	uint64_t *ofile_used; // Bit fd is set if ofile[fd] is open
+	uint32_t nofile;
 	struct inode *cwd; // Current directory
 	struct cred cred; // user's credentials for the process.
 	char name[16]; // Process name (debugging)
@@ -98,6 +121,7 @@ struct proc {
 	struct mmap_info mmap_info[NMMAP];
 	size_t mmap_count;
 	size_t effective_largest_sz; // Largest address when including mmap
+	struct vmarea vmareas[NVMAREA]; // Demand-loaded program segments
 	sighandler_t sig_handlers[__SIG_last];
 	int last_signal;
 };
@@ -117,6 +141,8 @@ fork(void);
 int
 growproc(int);
 int
+mmap_overlaps(struct proc *, uintptr_t, size_t);
+int
 kill(pid_t, int);
 struct cpu *
 mycpu(void);
@@ -130,6 +156,18 @@ void
 scheduler(void) __attribute__((noreturn));
 void
 sched(void);
+struct sched_stats;
+void
+sched_get_stats(struct sched_stats *st);
+struct proc_stats;
+void
+proc_get_stats(struct proc_stats *st);
+void
+preempt(int tick);
+int
+setnice(pid_t pid, int nice);
+int
+getnice(pid_t pid, int *nice);
 void
 setproc(struct proc *);
 #ifdef __KERNEL__
@@ -138,6 +176,8 @@ sleep(void *, struct spinlock *);
 #endif
 void
 userinit(void);
+struct proc *
+kthread_create(const char *, void (*)(void));
 int
 wait(int *);
 void
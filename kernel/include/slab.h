@@ -0,0 +1,16 @@
+#pragma once
+#include <stddef.h>
+
+struct slab_cache;
+struct slab_stats;
+
+void
+slab_init(void);
+struct slab_cache *
+slab_cache_create(const char *name, size_t size, size_t align);
+void *
+slab_alloc(struct slab_cache *c);
+void
+slab_free(struct slab_cache *c, void *obj);
+void
+slab_get_stats(struct slab_stats *st);
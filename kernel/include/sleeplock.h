@@ -14,6 +14,8 @@ struct sleeplock {
 };
 void
 acquiresleep(struct sleeplock *);
+int
+tryacquiresleep(struct sleeplock *);
 void
 releasesleep(struct sleeplock *);
 int
@@ -38,7 +38,12 @@
 #define SYS_munmap 35
 #define SYS_signal 36
 #define SYS_getcwd 37
-#define SYSCALL_AMT 37
+#define SYS_fsstat 38
+#define SYS_getpriority 39
+#define SYS_setpriority 40
+#define SYS_nanosleep 41
+#define SYS_clock_gettime 42
+#define SYSCALL_AMT 42
 #ifndef __ASSEMBLER__
 #include <stddef.h>
 #include "types.h"
@@ -61,7 +66,9 @@ __attribute__((unused)) static const char *syscall_names[SYSCALL_AMT + 1] = {
 	[SYS_fsync] = "fsync",			 [SYS_writev] = "writev",
 	[SYS_ioctl] = "ioctl",			 [SYS_mmap] = "mmap",
 	[SYS_munmap] = "munmap",		 [SYS_signal] = "signal",
-	[SYS_getcwd] = "getcwd",
+	[SYS_getcwd] = "getcwd",		 [SYS_fsstat] = "fsstat",
+	[SYS_getpriority] = "getpriority", [SYS_setpriority] = "setpriority",
+	[SYS_nanosleep] = "nanosleep", [SYS_clock_gettime] = "clock_gettime",
 };
 #endif
 #if defined(__KERNEL__) && !defined(__ASSEMBLER__)
@@ -13,4 +13,6 @@ struct timespec {
 	time_t tv_sec;
 	long tv_nsec;
 };
+typedef int clockid_t;
+#define CLOCK_MONOTONIC 1 // since boot, from the TSC
 #endif
@@ -0,0 +1,21 @@
+#pragma once
+#include "time.h"
+
+struct timer_stats;
+
+// A deadline on the timing wheel, in ticks.
+struct timeout {
+	time_t expires;
+	struct timeout *next, **pprev; // pprev is NULL if not armed
+};
+
+void
+timeout_init(void);
+void
+timeout_tick(time_t now);
+time_t
+timeout_next(void);
+int
+sleep_until(time_t deadline);
+void
+timeout_get_stats(struct timer_stats *);
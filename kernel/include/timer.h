@@ -1,3 +1,5 @@
 #pragma once
 void
 timerinit(void);
+void
+pit_wait(int ms);
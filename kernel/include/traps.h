@@ -36,4 +36,5 @@
 #define IRQ_PS2_MOUSE 12
 #define IRQ_IDE 14
 #define IRQ_ERROR 19
+#define IRQ_WAKE 20 // IPI that ends an idle CPU's hlt
 #define IRQ_SPURIOUS 31
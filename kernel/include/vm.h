@@ -21,6 +21,16 @@ int
 loaduvm(uintptr_t *, char *, struct inode *, uint32_t, uint32_t);
 uintptr_t *
 copyuvm(uintptr_t *, uint32_t);
+int
+uvm_cow(uintptr_t *pgdir, uintptr_t va);
+int
+pagefault(struct proc *p, uintptr_t va, int write);
+int
+uvm_prefault(struct proc *p, uintptr_t va, size_t len, int write);
+void
+vmareas_dup(struct vmarea *dst, struct vmarea *src);
+void
+vmareas_put(struct vmarea *areas);
 void
 switchuvm(struct proc *);
 void
@@ -31,5 +41,8 @@ void
 clearpteu(uintptr_t *pgdir, char *uva);
 int
 mappages(uintptr_t *pgdir, void *va, uintptr_t size, uintptr_t pa, int perm);
-void
-unmap_user_page(uintptr_t *pgdir, char *user_va);
+int
+mapdevice(uintptr_t *pgdir, uintptr_t va, uintptr_t size, uintptr_t pa,
+					int perm);
+int
+unmapuvm(uintptr_t *pgdir, uintptr_t va, uintptr_t size);
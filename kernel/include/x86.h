@@ -34,6 +34,21 @@ outw(uint16_t port, uint16_t data)
 	__asm__ __volatile__("out %0,%1" : : "a"(data), "d"(port));
 }
 
+static __always_inline uint32_t
+inl(uint16_t port)
+{
+	uint32_t data;
+
+	__asm__ __volatile__("in %1,%0" : "=a"(data) : "d"(port));
+	return data;
+}
+
+static __always_inline void
+outl(uint16_t port, uint32_t data)
+{
+	__asm__ __volatile__("out %0,%1" : : "a"(data), "d"(port));
+}
+
 static __always_inline void
 outsl(int port, const void *addr, int cnt)
 {
@@ -165,6 +180,20 @@ xchg(volatile uint32_t *addr, uintptr_t newval)
 	return result;
 }
 
+static __always_inline uintptr_t
+rcr0(void)
+{
+	uintptr_t val;
+	__asm__ __volatile__("mov %%cr0,%0" : "=r"(val));
+	return val;
+}
+
+static __always_inline void
+lcr0(uintptr_t val)
+{
+	__asm__ __volatile__("mov %0,%%cr0" : : "r"(val));
+}
+
 static __always_inline uintptr_t
 rcr2(void)
 {
@@ -179,12 +208,27 @@ lcr3(uintptr_t val)
 	__asm__ __volatile__("movq %0,%%cr3" : : "r"(val));
 }
 
+static __always_inline void
+invlpg(void *addr)
+{
+	__asm__ __volatile__("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
 static __always_inline void
 hlt(void)
 {
 	__asm__ __volatile__("hlt");
 }
 
+// Enable interrupts and halt. No interrupt can be taken
+// between the two, so one that was pending while interrupts
+// were off ends the hlt rather than coming just before it.
+static __always_inline void
+stihlt(void)
+{
+	__asm__ __volatile__("sti; hlt" : : : "memory");
+}
+
 static __always_inline void
 cpuid(uint32_t id, uint32_t count, uint32_t *a, uint32_t *b, uint32_t *c,
 			uint32_t *d)
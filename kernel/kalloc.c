@@ -1,6 +1,21 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and slabs (see slab.c). Allocates 4096-byte pages, and blocks
+// of 2^order physically contiguous pages.
+//
+// Free memory is kept by a binary buddy allocator: a free block
+// of 2^order pages starts at a multiple of its size, and when it
+// and its buddy (the other half of the block twice its size) are
+// both free they are merged. In front of it, each CPU keeps a list
+// of free single pages, which kpage_alloc() and kpage_free() use
+// without touching the buddy lock. A CPU refills its list from the
+// buddy allocator PCP_BATCH pages at a time and gives half of it
+// back when it grows past PCP_HIGH; only when the buddy allocator
+// is empty does it take half of another CPU's list.
+//
+// Idle CPUs also keep a pool of up to ZERO_TARGET pages that are
+// already zeroed, for kpage_alloc_zeroed() to hand out without
+// clearing them on the caller's time.
 
 #include <stdlib.h>
 #include <stdint.h>
@@ -14,10 +29,16 @@
 #include "param.h"
 #include "proc.h"
 #include "macros.h"
+#include "ioctl.h"
 #include <stddef.h>
 #include "boot/multiboot2.h"
 #include <string.h>
 
+#define PCP_BATCH 16 // pages a CPU takes from the buddy allocator at once
+#define PCP_HIGH 64 // pages a CPU keeps before giving half back
+#define ZERO_TARGET 256 // zeroed pages idle CPUs keep ready
+#define ZERO_BATCH 4 // pages an idle CPU zeroes before looking for work
+
 void
 freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
@@ -25,13 +46,37 @@ extern char end[]; // first address after kernel loaded from ELF file
 
 struct run {
 	struct run *next;
+	struct run *prev; // only kept on the buddy free lists
+};
+
+struct pageinfo {
+	uint16_t refcnt; // page tables mapping the page
+	uint8_t order; // of the block the page starts
+	uint8_t free; // starts a block on a buddy free list
 };
 
 struct {
 	struct spinlock lock[NCPU];
 	struct run *freelist[NCPU];
+	uint32_t nfree[NCPU];
+	struct spinlock buddy_lock;
+	struct run *buddy[KPAGE_NORDER];
+	uint64_t nbuddy[KPAGE_NORDER];
+	// Indexed by physical page number. Pages handed out
+	// before kinit2() are not counted and read as 0.
+	struct pageinfo *pages;
+	size_t npages;
+	struct mem_cpu_stats stats[NCPU]; // each only changed by its own CPU
+	// Zeroed free pages, with a reference count of 0.
+	struct spinlock zero_lock;
+	struct run *zeroed;
+	uint32_t nzeroed;
+	uint64_t zero_hits, zero_misses, zero_filled;
 } kmem;
 
+_Static_assert(sizeof(((struct mem_stats *)0)->nfree) == KPAGE_NORDER * sizeof(uint64_t),
+							 "struct mem_stats has one count per order");
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -43,12 +88,102 @@ kinit1(void *vstart, void *vend)
 	freerange(vstart, vend);
 }
 
+static void
+buddy_free(char *v, int order);
+static int
+pcp_refill(int id);
+
 void
 kinit2(void *vstart, void *vend)
 {
+	char *p;
+	size_t nbytes;
+	struct run *r;
+
 	for (int i = 0; i < min(NCPU, ncpu); i++)
 		initlock(&kmem.lock[i], "kmem");
-	freerange(vstart, vend);
+	initlock(&kmem.buddy_lock, "buddy");
+	initlock(&kmem.zero_lock, "kmem.zero");
+	// Carve the page table out of the front of the
+	// range before handing the rest to the free lists.
+	kmem.npages = V2P(vend) / PGSIZE;
+	nbytes = PGROUNDUP(kmem.npages * sizeof(*kmem.pages));
+	p = (char *)PGROUNDUP((uintptr_t)vstart);
+	memset(p, 0, nbytes);
+	kmem.pages = (struct pageinfo *)p;
+
+	// The pages kinit1() freed go to the buddy allocator too,
+	// so that they can be merged.
+	acquire(&kmem.buddy_lock);
+	for (int i = 0; i < min(NCPU, ncpu); i++) {
+		while ((r = kmem.freelist[i]) != NULL) {
+			kmem.freelist[i] = r->next;
+			buddy_free((char *)r, 0);
+		}
+		kmem.nfree[i] = 0;
+	}
+	release(&kmem.buddy_lock);
+	freerange(p + nbytes, vend);
+
+	// Start every CPU off with some pages of its own.
+	for (int i = 0; i < min(NCPU, ncpu); i++)
+		pcp_refill(i);
+}
+
+// Take one of the allocator's locks, counting whether
+// another CPU had it.
+static void
+kmem_acquire(struct spinlock *lk)
+{
+	struct mem_cpu_stats *st;
+
+	pushcli();
+	st = &kmem.stats[my_cpu_id()];
+	st->acquires++;
+	if (__atomic_load_n(&lk->locked, __ATOMIC_RELAXED))
+		st->contended++;
+	acquire(lk);
+	popcli();
+}
+
+static struct pageinfo *
+page_info(char *v)
+{
+	if (kmem.pages == NULL || V2P(v) / PGSIZE >= kmem.npages)
+		return NULL;
+	return &kmem.pages[V2P(v) / PGSIZE];
+}
+
+static uint16_t *
+page_refcnt(char *v)
+{
+	struct pageinfo *pi = page_info(v);
+	return pi ? &pi->refcnt : NULL;
+}
+
+// Record another mapping of the page at v, which
+// must have been returned by kpage_alloc().
+__nonnull(1) void kpage_ref(char *v)
+{
+	uint16_t *ref = page_refcnt(v);
+	if (ref == NULL || *ref == 0)
+		panic("kpage_ref");
+	__sync_add_and_fetch(ref, 1);
+}
+
+// Number of references to the page at v.
+__nonnull(1) int kpage_refcount(char *v)
+{
+	uint16_t *ref = page_refcnt(v);
+	return ref ? *ref : 0;
+}
+
+// The order of the block starting at v, which must
+// have been returned by kpages_alloc() or kpage_alloc().
+__nonnull(1) int kpage_order(char *v)
+{
+	struct pageinfo *pi = page_info(v);
+	return pi ? pi->order : 0;
 }
 
 void
@@ -59,20 +194,216 @@ freerange(void *vstart, void *vend)
 	p = (char *)PGROUNDUP((uintptr_t)vstart);
 	// If this fails, this will cause a page fault
 	// instead of a panic due to the memory for the VGA not being mapped.
+	if (kmem.pages != NULL) {
+		acquire(&kmem.buddy_lock);
+		for (; p + PGSIZE <= (char *)vend; p += PGSIZE)
+			buddy_free(p, 0);
+		release(&kmem.buddy_lock);
+	}
 	for (; p + PGSIZE <= (char *)vend; p += PGSIZE)
 		kpage_free(p);
 	popcli();
 }
 
+static void
+buddy_unlink(struct run *r, int order)
+{
+	if (r->prev)
+		r->prev->next = r->next;
+	else
+		kmem.buddy[order] = r->next;
+	if (r->next)
+		r->next->prev = r->prev;
+	kmem.nbuddy[order]--;
+}
+
+static void
+buddy_link(char *v, int order)
+{
+	struct run *r = (struct run *)v;
+	struct pageinfo *pi = page_info(v);
+
+	pi->order = order;
+	pi->free = 1;
+	r->prev = NULL;
+	r->next = kmem.buddy[order];
+	if (r->next)
+		r->next->prev = r;
+	kmem.buddy[order] = r;
+	kmem.nbuddy[order]++;
+}
+
+// Give the block of 2^order pages at v to the buddy allocator,
+// merging it with its buddy for as long as that is free.
+// Caller holds buddy_lock.
+static void
+buddy_free(char *v, int order)
+{
+	size_t pfn = V2P(v) / PGSIZE, bpfn;
+	struct pageinfo *bpi;
+
+	if (pfn & ((1UL << order) - 1))
+		panic("buddy_free");
+	for (; order < KPAGE_NORDER - 1; order++) {
+		bpfn = pfn ^ (1UL << order);
+		if (bpfn >= kmem.npages)
+			break;
+		bpi = &kmem.pages[bpfn];
+		if (!bpi->free || bpi->order != order)
+			break;
+		buddy_unlink((struct run *)P2V(bpfn * PGSIZE), order);
+		bpi->free = 0;
+		bpi->order = 0;
+		pfn &= ~(1UL << order);
+	}
+	buddy_link(P2V(pfn * PGSIZE), order);
+}
+
+// Take a block of 2^order pages, splitting a larger one if
+// need be. Caller holds buddy_lock.
+static char *
+buddy_alloc(int order)
+{
+	struct run *r;
+	int o;
+
+	for (o = order; o < KPAGE_NORDER && kmem.buddy[o] == NULL; o++)
+		;
+	if (o == KPAGE_NORDER)
+		return NULL;
+	r = kmem.buddy[o];
+	buddy_unlink(r, o);
+	// Give back the upper half until the block is the right size.
+	while (o > order) {
+		o--;
+		buddy_link((char *)r + (PGSIZE << o), o);
+	}
+	page_info((char *)r)->free = 0;
+	page_info((char *)r)->order = order;
+	return (char *)r;
+}
+
+// Give a list of single pages back to the buddy allocator.
+static void
+buddy_free_list(struct run *list)
+{
+	struct run *r;
+
+	kmem_acquire(&kmem.buddy_lock);
+	while ((r = list) != NULL) {
+		list = r->next;
+		buddy_free((char *)r, 0);
+	}
+	release(&kmem.buddy_lock);
+}
+
+// Give every CPU's cached pages and the zeroed pages back to
+// the buddy allocator, so that they can be merged into larger
+// blocks.
+static void
+drain_cpu_lists(void)
+{
+	struct run *list;
+
+	kmem_acquire(&kmem.zero_lock);
+	list = kmem.zeroed;
+	kmem.zeroed = NULL;
+	kmem.nzeroed = 0;
+	release(&kmem.zero_lock);
+	buddy_free_list(list);
+
+	for (int i = 0; i < min(NCPU, ncpu); i++) {
+		kmem_acquire(&kmem.lock[i]);
+		list = kmem.freelist[i];
+		kmem.freelist[i] = NULL;
+		kmem.nfree[i] = 0;
+		release(&kmem.lock[i]);
+		buddy_free_list(list);
+	}
+}
+
+// Move up to PCP_BATCH pages from the buddy allocator to
+// CPU id's list. Returns how many.
+static int
+pcp_refill(int id)
+{
+	struct run *batch = NULL, *last = NULL, *r;
+	int n;
+
+	kmem_acquire(&kmem.buddy_lock);
+	for (n = 0; n < PCP_BATCH; n++) {
+		if ((r = (struct run *)buddy_alloc(0)) == NULL)
+			break;
+		r->next = batch;
+		batch = r;
+		if (last == NULL)
+			last = r;
+	}
+	release(&kmem.buddy_lock);
+	if (n == 0)
+		return 0;
+	kmem_acquire(&kmem.lock[id]);
+	last->next = kmem.freelist[id];
+	kmem.freelist[id] = batch;
+	kmem.nfree[id] += n;
+	release(&kmem.lock[id]);
+	kmem.stats[id].refills++;
+	return n;
+}
+
+// Move half of CPU victim's list to CPU id's list.
+// Returns how many pages moved.
+static int
+pcp_steal(int id, int victim)
+{
+	struct run *list, *r;
+	uint32_t n;
+
+	kmem_acquire(&kmem.lock[victim]);
+	n = (kmem.nfree[victim] + 1) / 2;
+	if ((list = kmem.freelist[victim]) == NULL) {
+		release(&kmem.lock[victim]);
+		return 0;
+	}
+	r = list;
+	for (uint32_t i = 1; i < n && r->next != NULL; i++)
+		r = r->next;
+	kmem.freelist[victim] = r->next;
+	kmem.nfree[victim] -= n;
+	release(&kmem.lock[victim]);
+
+	kmem_acquire(&kmem.lock[id]);
+	r->next = kmem.freelist[id];
+	kmem.freelist[id] = list;
+	kmem.nfree[id] += n;
+	release(&kmem.lock[id]);
+	kmem.stats[id].steals += n;
+	return n;
+}
+
+static struct run *
+pcp_pop(int id)
+{
+	struct run *r;
+
+	kmem_acquire(&kmem.lock[id]);
+	if ((r = kmem.freelist[id]) != NULL) {
+		kmem.freelist[id] = r->next;
+		kmem.nfree[id]--;
+	}
+	release(&kmem.lock[id]);
+	return r;
+}
+
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
 // call to kpage_alloc().	(The exception is when
 // initializing the allocator; see kinit above.)
+// If v starts a block from kpages_alloc(), frees the whole block.
 __nonnull(1) void kpage_free(char *v)
 {
-	pushcli();
-	struct run *r;
-	int id = my_cpu_id();
+	struct run *r, *list = NULL;
+	struct pageinfo *pi;
 	// We do not allocate for devices.
 	if (V2IO(v) >= DEVBASE)
 		return;
@@ -81,16 +412,56 @@ __nonnull(1) void kpage_free(char *v)
 		(V2P(v) >= available_memory && likely(available_memory > 0)))
 		panic("kpage_free");
 
-	//if (kmem.use_lock)
-	acquire(&kmem.lock[id]);
+	// Shared pages are only freed once the last mapping goes away.
+	pi = page_info(v);
+	if (pi != NULL && pi->refcnt != 0 &&
+			__sync_sub_and_fetch(&pi->refcnt, 1) != 0)
+		return;
+
+	if (pi != NULL && pi->order > 0) {
+		kmem_acquire(&kmem.buddy_lock);
+		buddy_free(v, pi->order);
+		release(&kmem.buddy_lock);
+		return;
+	}
+
+	pushcli();
+	int id = my_cpu_id();
+
+	kmem_acquire(&kmem.lock[id]);
 	r = (struct run *)v;
 	r->next = kmem.freelist[id];
 	kmem.freelist[id] = r;
-	//if (kmem.use_lock)
+	// Hand the oldest half of a long list back.
+	if (++kmem.nfree[id] > PCP_HIGH && kmem.pages != NULL) {
+		for (r = kmem.freelist[id]; --kmem.nfree[id] > PCP_HIGH / 2;)
+			r = r->next;
+		list = r->next;
+		r->next = NULL;
+	}
 	release(&kmem.lock[id]);
+	kmem.stats[id].frees++;
+	if (list != NULL) {
+		buddy_free_list(list);
+		kmem.stats[id].drains++;
+	}
 	popcli();
 }
 
+static struct run *
+zero_pop(void)
+{
+	struct run *r;
+
+	kmem_acquire(&kmem.zero_lock);
+	if ((r = kmem.zeroed) != NULL) {
+		kmem.zeroed = r->next;
+		kmem.nzeroed--;
+	}
+	release(&kmem.zero_lock);
+	return r;
+}
+
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
@@ -101,137 +472,196 @@ kpage_alloc(void)
 	int id = my_cpu_id();
 	struct run *r;
 
-	//if (kmem.use_lock)
-	acquire(&kmem.lock[id]);
-	r = kmem.freelist[id];
-	if (r)
-		kmem.freelist[id] = r->next;
-	//if (kmem.use_lock)
-	release(&kmem.lock[id]);
-
-	if (!r) {
-		for (int i = 0; i < min(NCPU, ncpu); i++) {
-			acquire(&kmem.lock[i]);
-			r = kmem.freelist[i];
-			if (r)
-				kmem.freelist[i] = r->next;
-			release(&kmem.lock[i]);
-
-			if (r)
-				break;
-		}
+	if ((r = pcp_pop(id)) == NULL && kmem.pages != NULL && pcp_refill(id) > 0)
+		r = pcp_pop(id);
+	for (int i = 0; r == NULL && i < min(NCPU, ncpu); i++) {
+		if (i != id && pcp_steal(id, i) > 0)
+			r = pcp_pop(id);
 	}
+	if (r == NULL)
+		r = zero_pop();
+	if (r != NULL)
+		kmem.stats[id].allocs++;
 
 	popcli();
+	if (r != NULL) {
+		uint16_t *ref = page_refcnt((char *)r);
+		if (ref != NULL)
+			*ref = 1;
+	}
 	return (char *)r;
 }
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Allocate one page of physical memory filled with zeroes.
+char *
+kpage_alloc_zeroed(void)
+{
+	struct run *r;
+	char *p;
+	uint16_t *ref;
 
-typedef long Align;
+	if ((r = zero_pop()) != NULL) {
+		// The link was the only thing written since it was zeroed.
+		r->next = NULL;
+		if ((ref = page_refcnt((char *)r)) != NULL)
+			*ref = 1;
+		__sync_add_and_fetch(&kmem.zero_hits, 1);
+		return (char *)r;
+	}
+	__sync_add_and_fetch(&kmem.zero_misses, 1);
+	if ((p = kpage_alloc()) != NULL)
+		memset(p, 0, PGSIZE);
+	return p;
+}
 
-union header {
-	struct {
-		union header *ptr;
-		uint32_t size;
-	} s;
-	Align x;
-};
+// Called by an idle CPU: zero a few free pages for
+// kpage_alloc_zeroed(). Returns how many it zeroed, 0 once
+// the pool is full.
+int
+kpage_zero_idle(void)
+{
+	struct run *r;
+	int n;
 
-typedef union header Header;
+	if (kmem.pages == NULL)
+		return 0;
+	for (n = 0; n < ZERO_BATCH && kmem.nzeroed < ZERO_TARGET; n++) {
+		if ((r = (struct run *)kpage_alloc()) == NULL)
+			break;
+		memset(r, 0, PGSIZE);
+		*page_refcnt((char *)r) = 0;
+		kmem_acquire(&kmem.zero_lock);
+		r->next = kmem.zeroed;
+		kmem.zeroed = r;
+		kmem.nzeroed++;
+		kmem.zero_filled++;
+		release(&kmem.zero_lock);
+	}
+	return n;
+}
 
-static Header base;
-static Header *freep;
+// Allocate 2^order physically contiguous pages, aligned to
+// their size. kpage_free() on the first page frees them all.
+char *
+kpages_alloc(int order)
+{
+	char *p;
+
+	if (order == 0)
+		return kpage_alloc();
+	if (order < 0 || order >= KPAGE_NORDER || kmem.pages == NULL)
+		return NULL;
+	for (int tries = 0; tries < 2; tries++) {
+		kmem_acquire(&kmem.buddy_lock);
+		p = buddy_alloc(order);
+		release(&kmem.buddy_lock);
+		if (p != NULL) {
+			page_info(p)->refcnt = 1;
+			return p;
+		}
+		drain_cpu_lists();
+	}
+	return NULL;
+}
 
+// Turn the block at v from kpages_alloc() into single pages,
+// each with the block's reference count, that are freed one at a
+// time. Does nothing if v is a single page already.
 void
-kfree(void *ap)
+kpages_split(char *v)
 {
-	Header *bp, *p;
-
-	bp = (Header *)ap - 1;
-	for (p = freep; p && !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-		if (p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-			break;
+	struct pageinfo *pi = page_info(v);
 
-	if (!p)
+	if (pi == NULL)
 		return;
-	if (bp + bp->s.size == p->s.ptr) {
-		bp->s.size += p->s.ptr->s.size;
-		bp->s.ptr = p->s.ptr->s.ptr;
-	} else
-		bp->s.ptr = p->s.ptr;
-	if (p + p->s.size == bp) {
-		p->s.size += bp->s.size;
-		p->s.ptr = bp->s.ptr;
-	} else
-		p->s.ptr = bp;
-	freep = p;
-}
-
-static Header *
-morecore(__attribute__((unused)) uint32_t nu)
+	kmem_acquire(&kmem.buddy_lock);
+	for (int i = 1; i < (1 << pi->order); i++) {
+		pi[i].order = 0;
+		pi[i].refcnt = pi->refcnt;
+	}
+	pi->order = 0;
+	release(&kmem.buddy_lock);
+}
+
+// Take another reference to the 2^order pages at v, whether or
+// not the block has been split.
+void
+kpages_ref(char *v, int order)
 {
-	char *p;
-	Header *hp;
+	struct pageinfo *pi = page_info(v);
 
-	p = kpage_alloc();
-	if (p == 0)
-		return 0;
-	hp = (Header *)p;
-	hp->s.size = 4096 / sizeof(Header); // kalloc always allocates 4096 bytes
-	kfree((void *)(hp + 1));
-	return freep;
-}
-
-void *
-kmalloc(size_t nbytes)
-{
-	Header *p, *prevp;
-	uint32_t nunits;
-
-	nunits = (nbytes + sizeof(Header) - 1) / sizeof(Header) + 1;
-	if ((prevp = freep) == 0) {
-		base.s.ptr = freep = prevp = &base;
-		base.s.size = 0;
-	}
-	for (p = prevp->s.ptr;; prevp = p, p = p->s.ptr) {
-		if (!p)
-			return 0;
-		if (p->s.size >= nunits) {
-			if (p->s.size == nunits)
-				prevp->s.ptr = p->s.ptr;
-			else {
-				p->s.size -= nunits;
-				p += p->s.size;
-				p->s.size = nunits;
-			}
-			freep = prevp;
-			return (void *)(p + 1);
+	if (pi == NULL)
+		panic("kpages_ref");
+	kmem_acquire(&kmem.buddy_lock);
+	if (pi->order == order) {
+		__sync_add_and_fetch(&pi->refcnt, 1);
+	} else {
+		for (int i = 0; i < (1 << order); i++)
+			__sync_add_and_fetch(&pi[i].refcnt, 1);
+	}
+	release(&kmem.buddy_lock);
+}
+
+// Drop a reference to the 2^order pages at v, freeing those
+// that no page table maps anymore.
+void
+kpages_put(char *v, int order)
+{
+	struct pageinfo *pi = page_info(v);
+
+	if (pi == NULL)
+		panic("kpages_put");
+	kmem_acquire(&kmem.buddy_lock);
+	if (pi->order == order) {
+		if (__sync_sub_and_fetch(&pi->refcnt, 1) == 0)
+			buddy_free(v, order);
+	} else {
+		for (int i = 0; i < (1 << order); i++) {
+			if (__sync_sub_and_fetch(&pi[i].refcnt, 1) == 0)
+				buddy_free(v + i * PGSIZE, 0);
 		}
-		if (p == freep)
-			if ((p = morecore(nunits)) == 0)
-				return 0;
 	}
+	release(&kmem.buddy_lock);
 }
-__attribute__((malloc)) __nonnull(1) void *krealloc(void *ptr, size_t size)
+
+// The smallest order whose blocks hold n bytes.
+int
+kpages_order(size_t n)
 {
-	void *newptr = kmalloc(size);
-	if (!newptr)
-		return NULL;
-	Header *hdr = (Header *)ptr - 1;
-	memcpy(newptr, ptr, min(hdr->s.size, size));
-	kfree(ptr);
+	int order = 0;
 
-	return newptr;
+	while ((size_t)PGSIZE << order < n)
+		order++;
+	return order;
 }
 
-__attribute__((malloc)) void *
-kcalloc(size_t size)
+// How many pages are free, give or take what other CPUs are
+// doing meanwhile.
+size_t
+kpages_free(void)
 {
-	void *ptr = kmalloc(size);
-	if (ptr == NULL)
-		return NULL;
-	memset(ptr, '\0', size);
-	return ptr;
+	size_t n = kmem.nzeroed;
+
+	for (int i = 0; i < min(NCPU, ncpu); i++)
+		n += kmem.nfree[i];
+	for (int i = 0; i < KPAGE_NORDER; i++)
+		n += kmem.nbuddy[i] << i;
+	return n;
+}
+
+void
+kmem_get_stats(struct mem_stats *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->pages = kmem.npages;
+	for (int i = 0; i < min(NCPU, ncpu); i++)
+		st->cached += kmem.nfree[i];
+	for (int i = 0; i < KPAGE_NORDER; i++)
+		st->nfree[i] = kmem.nbuddy[i];
+	st->zeroed = kmem.nzeroed;
+	st->zero_hits = kmem.zero_hits;
+	st->zero_misses = kmem.zero_misses;
+	st->zero_filled = kmem.zero_filled;
+	st->ncpu = min(ncpu, MEMSTATS_NCPU);
+	memcpy(st->cpu, kmem.stats, st->ncpu * sizeof(st->cpu[0]));
 }
@@ -7,6 +7,10 @@
 #include <string.h>
 #include "bio.h"
 #include "proc.h"
+#include "macros.h"
+#include "trap.h"
+#include "ioctl.h"
+#include "timeout.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -20,7 +24,14 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the transaction has been committed.
+//
+// Commits are done by the logflush kernel thread, not by
+// end_op(). Once the last outstanding operation ends, it
+// waits a tick so that more operations can join the
+// transaction, then writes them all to the log under one
+// header write, and installs them. log_sync() waits for
+// everything that has ended so far to be committed.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -31,57 +42,85 @@
 //   ...
 // Log appends are synchronous.
 
+// As many blocks as the header block can name.
+#define LOGMAXBLOCKS (BSIZE / sizeof(int) - 1)
+
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
 	int n;
-	int block[LOGSIZE];
+	int block[LOGMAXBLOCKS];
 };
 
 struct log {
 	struct spinlock lock;
 	int start;
-	int size;
+	int size; // usable log blocks, not counting the header
 	int outstanding; // how many FS sys calls are executing.
 	int committing; // in commit(), please wait.
+	int forced; // someone is waiting for a commit; don't delay it.
+	uint64_t seq; // number of the open transaction
+	uint64_t committed; // last transaction whose header is on disk
+	uint32_t nbuf; // buffers in the block cache
 	int dev;
 	struct logheader lh;
 };
 struct log log;
 
+// Log blocks are written to disk up to this many at a time, so
+// the disk queue can merge them into a few large commands.
+#define LOGBATCH 8
+
 static void
 recover_from_log(void);
 static void
 commit(void);
+static void
+log_flusher(void);
 
 void
 initlog(int dev)
 {
-	if (sizeof(struct logheader) >= BSIZE)
+	if (sizeof(struct logheader) > BSIZE)
 		panic("initlog: too big logheader");
 
 	struct superblock sb;
+	struct bio_stats st;
 	initlock(&log.lock, "log");
 	read_superblock(dev, &sb);
+	block_get_stats(&st);
 	log.start = sb.logstart;
-	log.size = sb.nlog;
+	log.nbuf = st.nbuf;
+	// Logged blocks stay pinned in the cache until they are
+	// installed, so leave at least half of it for everything else.
+	log.size = min(min(sb.nlog - 1, LOGMAXBLOCKS), st.nbuf / 2);
+	if (log.size < MAXOPBLOCKS)
+		panic("initlog: log too small");
 	log.dev = dev;
+	log.seq = 1;
 	recover_from_log();
+	if (kthread_create("logflush", log_flusher) == NULL)
+		panic("initlog: logflush");
 }
 
 // Copy committed blocks from log to their home location
 static void
 install_trans(void)
 {
-	int tail;
+	struct buf *dbufs[LOGBATCH];
+	int tail, n = 0;
 
 	for (tail = 0; tail < log.lh.n; tail++) {
 		struct buf *lbuf = block_read(log.dev, log.start + tail + 1); // read log block
 		struct buf *dbuf = block_read(log.dev, log.lh.block[tail]); // read dst
 		memmove(dbuf->data, lbuf->data, BSIZE); // copy block to dst
-		block_write(dbuf); // write dst to disk
 		block_release(lbuf);
-		block_release(dbuf);
+		dbufs[n++] = dbuf;
+		if (n == LOGBATCH || tail == log.lh.n - 1) {
+			block_write_batch(dbufs, n); // write dst to disk
+			while (n > 0)
+				block_release(dbufs[--n]);
+		}
 	}
 }
 
@@ -131,10 +170,15 @@ begin_op(void)
 {
 	acquire(&log.lock);
 	while (1) {
-		if (log.committing) {
+		if (log.committing || log.forced) {
 			sleep(&log, &log.lock);
-		} else if (log.lh.n + (log.outstanding + 1) * MAXOPBLOCKS > LOGSIZE) {
-			// this op might exhaust log space; wait for commit.
+		} else if (log.lh.n + (log.outstanding + 1) * MAXOPBLOCKS > log.size) {
+			// this op might exhaust log space; wait for commit,
+			// or, if nothing is logged yet, for others to end.
+			if (log.lh.n > 0) {
+				log.forced = 1;
+				wakeup(&log.seq);
+			}
 			sleep(&log, &log.lock);
 		} else {
 			log.outstanding += 1;
@@ -145,35 +189,112 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// Lets logflush commit if this was the last outstanding operation.
 void
 end_op(void)
 {
-	int do_commit = 0;
-
 	acquire(&log.lock);
 	log.outstanding -= 1;
 	if (log.committing)
 		panic("log.committing");
 	if (log.outstanding == 0) {
-		do_commit = 1;
-		log.committing = 1;
-	} else {
-		// begin_op() may be waiting for log space,
-		// and decrementing log.outstanding has decreased
-		// the amount of reserved space.
-		wakeup(&log);
+		// Nothing to commit, so no commit will clear forced.
+		if (log.lh.n == 0)
+			log.forced = 0;
+		wakeup(&log.seq);
+	}
+	// begin_op() may be waiting for log space,
+	// and decrementing log.outstanding has decreased
+	// the amount of reserved space.
+	wakeup(&log);
+	release(&log.lock);
+}
+
+// Record that the current transaction changes ip.
+// Caller must be inside a transaction and hold ip->lock.
+void
+log_mark(struct inode *ip)
+{
+	// begin_op() keeps new operations out while a commit
+	// runs, so log.seq is the transaction the caller is in.
+	ip->logseq = log.seq;
+}
+
+// The open transaction: none after it has changed anything.
+uint64_t
+log_seq(void)
+{
+	uint64_t seq;
+
+	acquire(&log.lock);
+	seq = log.seq;
+	release(&log.lock);
+	return seq;
+}
+
+// Wait until transaction seq, and so every one before it,
+// is committed. Commits the open transaction early if need be.
+void
+log_force(uint64_t seq)
+{
+	acquire(&log.lock);
+	seq = min(seq, log.seq);
+	while (log.committed < seq) {
+		if (seq == log.seq && !log.committing) {
+			if (log.lh.n > 0) {
+				log.forced = 1;
+				wakeup(&log.seq);
+			} else if (log.outstanding == 0)
+				break; // nothing was written after all
+		}
+		sleep(&log, &log.lock);
 	}
 	release(&log.lock);
+}
+
+// Wait until every operation that has ended so far is committed.
+void
+log_sync(void)
+{
+	log_force(~0UL);
+}
+
+// The logflush kernel thread: commits a transaction once
+// nothing is using it, after giving others a tick to join in.
+static void
+log_flusher(void)
+{
+	time_t now;
+
+	acquire(&log.lock);
+	for (;;) {
+		if (log.lh.n == 0 || log.outstanding > 0) {
+			sleep(&log.seq, &log.lock);
+			continue;
+		}
+		if (!log.forced) {
+			release(&log.lock);
+			acquire(&tickslock);
+			now = ticks;
+			release(&tickslock);
+			sleep_until(now + 1);
+			acquire(&log.lock);
+			if (log.outstanding > 0)
+				continue;
+		}
+		log.committing = 1;
+		log.seq++;
+		release(&log.lock);
 
-	if (do_commit) {
 		// call commit w/o holding locks, since not allowed
 		// to sleep with locks.
 		commit();
+
 		acquire(&log.lock);
+		log.committed = log.seq - 1;
 		log.committing = 0;
+		log.forced = 0;
 		wakeup(&log);
-		release(&log.lock);
 	}
 }
 
@@ -181,15 +302,23 @@ end_op(void)
 static void
 write_log(void)
 {
-	int tail;
+	struct buf *tos[LOGBATCH];
+	int tail, n = 0;
+	// Each log block held for the batch takes a clean buffer,
+	// and the lh.n blocks being logged already pin as many.
+	int batch = max(1, min(LOGBATCH, (int)log.nbuf - log.lh.n - 2));
 
 	for (tail = 0; tail < log.lh.n; tail++) {
 		struct buf *to = block_read(log.dev, log.start + tail + 1); // log block
 		struct buf *from = block_read(log.dev, log.lh.block[tail]); // cache block
 		memmove(to->data, from->data, BSIZE);
-		block_write(to); // write the log
 		block_release(from);
-		block_release(to);
+		tos[n++] = to;
+		if (n == batch || tail == log.lh.n - 1) {
+			block_write_batch(tos, n); // write the log
+			while (n > 0)
+				block_release(tos[--n]);
+		}
 	}
 }
 
@@ -219,7 +348,7 @@ log_write(struct buf *b)
 {
 	int i;
 
-	if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+	if (log.lh.n >= log.size)
 		panic("too big a transaction");
 	if (log.outstanding < 1)
 		panic("log_write outside of trans");
@@ -11,12 +11,16 @@
 #include "null.h"
 #include "console.h"
 #include "kalloc.h"
+#include "slab.h"
 #include "mp.h"
 #include "ioapic.h"
 #include "uart.h"
 #include "pci.h"
 #include "bio.h"
 #include "file.h"
+#include "pipe.h"
+#include "dcache.h"
+#include "timeout.h"
 #include "ide.h"
 #include "vm.h"
 #include "picirq.h"
@@ -46,6 +50,7 @@ main(struct multiboot_info *mbinfo)
 	\*-----------------------*/
 	uartinit1(); // serial port
 	kinit1(end, P2V(4 * 1024 * 1024)); // phys page allocator
+	slab_init(); // kmalloc
 	parse_multiboot(mbinfo);
 	kernel_assert(available_memory != 0);
 	// Past kvmalloc, addresses need to be virtual.
@@ -67,16 +72,19 @@ main(struct multiboot_info *mbinfo)
 	consoleinit(); // console hardware
 	nulldrvinit();
 	pinit(); // process table
+	timeout_init(); // sleep timers
 	tvinit(); // trap vectors
-	block_init(); // buffer cache
 	fileinit(); // file table
+	pipeinit();
+	dcache_init(); // name cache
+	pci_init(); // before ideinit, which looks for a DMA controller
 	ideinit(); // disk
 	ps2mouseinit();
 	//timerinit();
 	rust_hello_world();
-	pci_init();
 	startothers(); // start other processors
 	kinit2(P2V(4 * 1024 * 1024), P2V(available_memory)); // must come after startothers()
+	block_init(); // buffer cache, sized from free memory
 	userinit(); // first user process
 	mpmain(); // finish this processor's setup
 }
@@ -3,7 +3,7 @@
 #include "spinlock.h"
 #include "file.h"
 #include "pipe.h"
-#include "kalloc.h"
+#include "slab.h"
 
 #define PIPESIZE 512
 
@@ -16,6 +16,14 @@ struct pipe {
 	int writeopen; // write fd is still open
 };
 
+static struct slab_cache *pipe_cache;
+
+void
+pipeinit(void)
+{
+	pipe_cache = slab_cache_create("pipe", sizeof(struct pipe), 0);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -25,7 +33,7 @@ pipealloc(struct file **f0, struct file **f1)
 	*f0 = *f1 = 0;
 	if ((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
 		goto bad;
-	if ((p = (struct pipe *)kpage_alloc()) == 0)
+	if ((p = slab_alloc(pipe_cache)) == 0)
 		goto bad;
 	p->readopen = 1;
 	p->writeopen = 1;
@@ -44,7 +52,7 @@ pipealloc(struct file **f0, struct file **f1)
 
 bad:
 	if (p)
-		kpage_free((char *)p);
+		slab_free(pipe_cache, p);
 	if (*f0)
 		fileclose(*f0);
 	if (*f1)
@@ -65,7 +73,7 @@ pipeclose(struct pipe *p, int writable)
 	}
 	if (p->readopen == 0 && p->writeopen == 0) {
 		release(&p->lock);
-		kpage_free((char *)p);
+		slab_free(pipe_cache, p);
 	} else
 		release(&p->lock);
 }
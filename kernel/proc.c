@@ -6,6 +6,7 @@
 #include <stddef.h>
 #include <string.h>
 #include "drivers/mmu.h"
+#include "drivers/memlayout.h"
 #include "drivers/lapic.h"
 #include "defs.h"
 #include "param.h"
@@ -23,14 +24,83 @@
 #include "compiler_attributes.h"
 #include "types.h"
 #include "kernel_signal.h"
+#include "macros.h"
+#include "ioctl.h"
+#include <sys/resource.h>
+#include "timeout.h"
 
 #define W_EXITCODE(ret, signal) ((ret) << 8 | (signal))
 
+// ptable.lock guards the process table, parents and children.
 struct {
 	struct spinlock lock;
 	struct proc proc[NPROC];
 } ptable;
 
+// Sleeping processes are kept on the wait queue that their
+// channel hashes to, so wakeup() only looks at those that might
+// be sleeping on its channel. A process changes to or from
+// SLEEPING only with its queue's lock held, so wakeup() can't
+// miss a sleeper.
+// Lock order: ptable.lock, a wait queue lock, a run queue lock.
+#define NWAITQ 128
+
+struct waitq {
+	struct spinlock lock;
+	struct proc *head;
+};
+
+static struct waitq waitq[NWAITQ];
+
+// Each CPU runs the RUNNABLE processes on its own queue, and
+// takes one from another CPU's queue when its own is empty. A
+// process is on the queue of p->cpu, the CPU it last ran on,
+// unless a CPU has just taken it to run. A CPU holds its queue's
+// lock across swtch() to and from a process; that keeps other
+// CPUs from running the process (or, in wait(), freeing its
+// stack) before its context is saved.
+// Lock order: ptable.lock, then a run queue lock.
+//
+// Queues are kept in order of virtual runtime: the cycles a
+// process ran, scaled down by its weight, which falls by about
+// a fifth for each step of nice. The process that is owed the
+// CPU most runs next, and a running one is preempted on a tick
+// once it is SCHED_GRAN_NSEC ahead of the head of its queue. A
+// process that wakes up may lag at most SCHED_WAKEUP_NSEC behind
+// the queue, so one that mostly sleeps runs soon after it wakes,
+// but can't save up for a burst.
+#define SCHED_GRAN_NSEC 1000000ULL
+#define SCHED_WAKEUP_NSEC 5000000ULL
+#define NICE_0_WEIGHT 1024
+
+// SCHED_GRAN_NSEC and SCHED_WAKEUP_NSEC in TSC cycles, which
+// is what virtual runtime is kept in. Set by pinit().
+static uint64_t sched_gran, sched_wakeup;
+
+struct runq {
+	struct spinlock lock;
+	struct proc *head, *tail;
+	uint32_t n;
+	uint64_t min_vruntime; // never goes back
+	struct proc *curr; // running on this CPU, or 0
+	int resched; // a woken process should preempt curr
+	int idle; // halted with its timer stopped; kick to wake
+	struct sched_cpu_stats stats;
+};
+
+static struct runq runq[NCPU];
+
+static const uint32_t nice_weight[NICE_MAX - NICE_MIN + 1] = {
+	/* -20 */ 88761, 71755, 56483, 46273, 36291,
+	/* -15 */ 29154, 23254, 18705, 14949, 11916,
+	/* -10 */ 9548,	 7620,	6100,	 4904,	3906,
+	/*  -5 */ 3121,	 2501,	1991,	 1586,	1277,
+	/*   0 */ 1024,	 820,		655,	 526,		423,
+	/*   5 */ 335,	 272,		215,	 172,		137,
+	/*  10 */ 110,	 87,		70,		 56,		45,
+	/*  15 */ 36,		 29,		23,		 18,		15,
+};
+
 static struct proc *initproc;
 
 int nextpid = 1;
@@ -39,13 +109,289 @@ forkret(void);
 extern void
 trapret(void);
 
-static void
-wakeup1(void *chan);
-
 void
 pinit(void)
 {
 	initlock(&ptable.lock, "ptable");
+	for (int i = 0; i < NCPU; i++)
+		initlock(&runq[i].lock, "runq");
+	for (int i = 0; i < NWAITQ; i++)
+		initlock(&waitq[i].lock, "waitq");
+	sched_gran = nsec_to_tsc(SCHED_GRAN_NSEC);
+	sched_wakeup = nsec_to_tsc(SCHED_WAKEUP_NSEC);
+}
+
+static struct waitq *
+waitq_of(void *chan)
+{
+	// Fibonacci hashing; channels are mostly addresses of
+	// structs, so the low bits say little.
+	return &waitq[((uintptr_t)chan * 0x9e3779b97f4a7c15ULL) >> 57];
+}
+
+// Caller holds wq->lock.
+static void
+waitq_remove(struct waitq *wq, struct proc *p)
+{
+	if (p->wq_prev)
+		p->wq_prev->wq_next = p->wq_next;
+	else
+		wq->head = p->wq_next;
+	if (p->wq_next)
+		p->wq_next->wq_prev = p->wq_prev;
+	p->wq_next = p->wq_prev = NULL;
+}
+
+// Acquire rq's lock, counting how often another CPU had it.
+static void
+runq_acquire(struct runq *rq)
+{
+	struct sched_cpu_stats *st;
+
+	pushcli();
+	st = &runq[my_cpu_id()].stats;
+	st->acquires++;
+	if (__atomic_load_n(&rq->lock.locked, __ATOMIC_RELAXED))
+		st->contended++;
+	acquire(&rq->lock);
+	popcli();
+}
+
+// Queue p on rq behind every process with as little virtual
+// runtime. Searches from the back, where a process that used
+// up its turn belongs. Caller holds rq->lock.
+static void
+runq_push(struct runq *rq, struct proc *p)
+{
+	struct proc *q = rq->tail;
+
+	while (q != NULL && q->vruntime > p->vruntime)
+		q = q->rq_prev;
+	p->rq_prev = q;
+	p->rq_next = q ? q->rq_next : rq->head;
+	if (p->rq_next)
+		p->rq_next->rq_prev = p;
+	else
+		rq->tail = p;
+	if (q)
+		q->rq_next = p;
+	else
+		rq->head = p;
+	rq->n++;
+}
+
+// Take the process at the head of rq, if any.
+// Caller holds rq->lock.
+static struct proc *
+runq_pop(struct runq *rq)
+{
+	struct proc *p = rq->head;
+
+	if (p == NULL)
+		return NULL;
+	rq->head = p->rq_next;
+	if (rq->head)
+		rq->head->rq_prev = NULL;
+	else
+		rq->tail = NULL;
+	p->rq_next = p->rq_prev = NULL;
+	rq->n--;
+	return p;
+}
+
+// Move rq's min_vruntime up to the least virtual runtime of
+// its processes. Caller holds rq->lock.
+static void
+runq_update_min(struct runq *rq)
+{
+	uint64_t v;
+
+	if (rq->curr && rq->head)
+		v = min(rq->curr->vruntime, rq->head->vruntime);
+	else if (rq->curr || rq->head)
+		v = rq->curr ? rq->curr->vruntime : rq->head->vruntime;
+	else
+		return;
+	if (v > rq->min_vruntime)
+		rq->min_vruntime = v;
+}
+
+// Charge p, which is running, for the time since it was last
+// charged. Caller holds the lock of p's run queue.
+static void
+update_curr(struct proc *p)
+{
+	uint64_t now = rdtsc(), delta = now - p->lastrun;
+
+	p->lastrun = now;
+	p->runtime += delta;
+	p->vruntime += delta * NICE_0_WEIGHT / nice_weight[p->nice - NICE_MIN];
+	runq_update_min(&runq[p->cpu]);
+}
+
+// A process was just queued on rq: wake rq's CPU if it is
+// idle, or if it is busy running something else, an idle CPU
+// that can steal from it. Interrupts are off.
+static void
+runq_kick(struct runq *rq)
+{
+	int self = mycpu() - cpus, id = rq - runq;
+
+	__sync_synchronize(); // pairs with idle()
+	if (!__atomic_load_n(&rq->idle, __ATOMIC_RELAXED)) {
+		if (__atomic_load_n(&rq->curr, __ATOMIC_RELAXED) == NULL ||
+				__atomic_load_n(&rq->n, __ATOMIC_RELAXED) == 0)
+			return;
+		for (id = 0; id < ncpu; id++) {
+			if (__atomic_load_n(&runq[id].idle, __ATOMIC_RELAXED))
+				break;
+		}
+		if (id == ncpu)
+			return;
+	}
+	if (id != self) {
+		runq[self].stats.kicks++;
+		lapic_kick(cpus[id].apicid);
+	}
+}
+
+// Halt until an interrupt. The timer is stopped meanwhile
+// but for the next tick the timing wheel has work at, at most
+// a wheel turn away, so that an idle CPU is not woken HZ times
+// a second; a process queued here, or for stealing, comes with
+// a kick from runq_kick().
+static void
+idle(struct runq *rq)
+{
+	time_t next;
+	uint64_t now;
+
+	cli();
+	__atomic_store_n(&rq->idle, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&rq->n, __ATOMIC_SEQ_CST) == 0) {
+		rq->stats.halts++;
+		next = timeout_next();
+		now = nsec();
+		if (next == 0)
+			lapic_oneshot(~0ULL);
+		else
+			lapic_oneshot(next * TICK_NSEC - min(now, next * TICK_NSEC));
+		stihlt();
+		cli();
+		lapic_periodic();
+	}
+	__atomic_store_n(&rq->idle, 0, __ATOMIC_RELAXED);
+	sti();
+}
+
+// Make p RUNNABLE and queue it on its CPU. Caller holds the
+// lock of the wait queue p is on, if it was sleeping, or
+// ptable.lock if p is new.
+static void
+setrunnable(struct proc *p)
+{
+	struct runq *rq = &runq[p->cpu];
+
+	runq_acquire(rq);
+	if (rq->min_vruntime > sched_wakeup)
+		p->vruntime = max(p->vruntime, rq->min_vruntime - sched_wakeup);
+	p->state = RUNNABLE;
+	runq_push(rq, p);
+	if (rq->curr && p->vruntime + sched_gran < rq->curr->vruntime)
+		rq->resched = 1;
+	release(&rq->lock);
+	runq_kick(rq);
+}
+
+// How many processes rq's CPU has, counting the one it is
+// running. Read without rq->lock, so only a hint.
+static int
+runq_load(struct runq *rq)
+{
+	return __atomic_load_n(&rq->n, __ATOMIC_RELAXED) +
+				 (__atomic_load_n(&rq->curr, __ATOMIC_RELAXED) != NULL);
+}
+
+// The CPU with the fewest processes, for a new process: an
+// idle one if there is one.
+static int
+runq_idlest(void)
+{
+	int best = my_cpu_id(), load = runq_load(&runq[best]), l;
+
+	for (int i = 0; i < ncpu && load > 0; i++) {
+		if (__atomic_load_n(&runq[i].idle, __ATOMIC_RELAXED))
+			return i;
+		if ((l = runq_load(&runq[i])) < load) {
+			best = i;
+			load = l;
+		}
+	}
+	return best;
+}
+
+// Take a process from the queue of another CPU for CPU id,
+// which has run out of its own, or return 0.
+static struct proc *
+runq_steal(int id)
+{
+	struct proc *p;
+
+	for (int i = 1; i < ncpu; i++) {
+		struct runq *victim = &runq[(id + i) % ncpu];
+
+		if (__atomic_load_n(&victim->n, __ATOMIC_RELAXED) == 0)
+			continue;
+		runq_acquire(victim);
+		p = runq_pop(victim);
+		// Keep its place relative to the others on the new queue.
+		if (p != NULL)
+			p->vruntime = p->vruntime - min(p->vruntime, victim->min_vruntime) +
+										runq[id].min_vruntime;
+		release(&victim->lock);
+		if (p != NULL) {
+			runq[id].stats.steals++;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+// Describe every process in st[0..NPROCSTATS).
+void
+proc_get_stats(struct proc_stats *st)
+{
+	struct proc *p;
+	int i = 0;
+
+	memset(st, 0, NPROCSTATS * sizeof(*st));
+	acquire(&ptable.lock);
+	for (p = ptable.proc; p < &ptable.proc[NPROC] && i < NPROCSTATS; p++) {
+		if (p->state == UNUSED)
+			continue;
+		st[i].pid = p->pid;
+		st[i].ppid = p->parent ? p->parent->pid : 0;
+		st[i].state = p->state;
+		st[i].nice = p->nice;
+		st[i].cpu = p->cpu;
+		strncpy(st[i].name, p->name, sizeof(st[i].name) - 1);
+		st[i].runtime = p->runtime;
+		st[i].switches = p->nswitch;
+		i++;
+	}
+	release(&ptable.lock);
+}
+
+// Copy the scheduler's counters to st.
+void
+sched_get_stats(struct sched_stats *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->ncpu = min(ncpu, SCHEDSTATS_NCPU);
+	for (uint32_t i = 0; i < st->ncpu; i++) {
+		st->cpu[i] = runq[i].stats;
+		st->cpu[i].nrunnable = runq[i].n;
+	}
 }
 
 // Must be called with interrupts disabled
@@ -149,6 +495,11 @@ found:
 	p->cred.uid = 0;
 	p->cred.gid = 0;
 
+	p->nice = 0;
+	p->runtime = 0;
+	p->vruntime = 0;
+	p->nswitch = 0;
+
 	memset(p->strace_mask_ptr, 0, SYSCALL_AMT);
 
 	for (int i = 0; i < __SIG_last; i++) {
@@ -159,6 +510,33 @@ found:
 	return p;
 }
 
+// Start a kernel thread running fn, which must never return.
+// It has no user memory and is nobody's child.
+struct proc *
+kthread_create(const char *name, void (*fn)(void))
+{
+	struct proc *p;
+
+	if ((p = allocproc()) == NULL)
+		return NULL;
+	if ((p->pgdir = setupkvm()) == 0) {
+		kpage_free(p->kstack);
+		p->kstack = 0;
+		p->state = UNUSED;
+		return NULL;
+	}
+	// forkret() returns to fn instead of trapret.
+	*(uintptr_t *)(p->context + 1) = (uintptr_t)fn;
+	__safestrcpy(p->name, name, sizeof(p->name));
+
+	acquire(&ptable.lock);
+	p->cpu = runq_idlest();
+	p->vruntime = runq[p->cpu].min_vruntime;
+	setrunnable(p);
+	release(&ptable.lock);
+	return p;
+}
+
 // Set up first user process.
 void
 userinit(void)
@@ -192,11 +570,25 @@ userinit(void)
 	// because the assignment might not be atomic.
 	acquire(&ptable.lock);
 
-	p->state = RUNNABLE;
+	p->cpu = my_cpu_id();
+	setrunnable(p);
 
 	release(&ptable.lock);
 }
 
+// Does [va, va + len) overlap anything p has mapped with mmap()?
+int
+mmap_overlaps(struct proc *p, uintptr_t va, size_t len)
+{
+	for (int i = 0; i < NMMAP; i++) {
+		struct mmap_info *m = &p->mmap_info[i];
+		if (m->length != 0 && va < m->virt_addr + PGROUNDUP(m->length) &&
+				m->virt_addr < va + len)
+			return 1;
+	}
+	return 0;
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -207,8 +599,16 @@ growproc(int n)
 
 	sz = curproc->sz;
 	if (n > 0) {
-		if ((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+		// Only reserve the address space; pagefault()
+		// backs each page with zeroes on first touch. It
+		// must not run into anything mmap() put above it,
+		// nor ask for more than is free, so that running
+		// out shows up here and not as a fault.
+		if (sz + n < sz || sz + n >= USERTOP ||
+				mmap_overlaps(curproc, sz, n) ||
+				PGROUNDUP((uintptr_t)n) / PGSIZE + HEAP_RESERVE > kpages_free())
 			return -ENOMEM;
+		sz += n;
 	} else if (n < 0) {
 		if ((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
 			return -EFAULT;
@@ -227,7 +627,7 @@ growproc(int n)
 pid_t
 fork(void)
 {
-	int i, pid;
+	int pid;
 	struct proc *np;
 	struct proc *curproc = myproc();
 
@@ -243,19 +643,27 @@ fork(void)
 		np->state = UNUSED;
 		return -EIO;
 	}
+	// copyuvm() write-protected our pages; drop the stale TLB entries.
+	switchuvm(curproc);
+	if (fd_copy(np) < 0) {
+		freevm(np->pgdir);
+		np->pgdir = 0;
+		kpage_free(np->kstack);
+		np->kstack = 0;
+		np->state = UNUSED;
+		return -ENOMEM;
+	}
 	np->sz = curproc->sz;
 	np->effective_largest_sz = curproc->effective_largest_sz;
 	np->mmap_count = curproc->mmap_count;
 	memcpy(np->mmap_info, curproc->mmap_info, sizeof(np->mmap_info));
+	vmareas_dup(np->vmareas, curproc->vmareas);
 	np->parent = curproc;
 	*np->tf = *curproc->tf;
 
 	// Clear %eax so that fork returns 0 in the child.
 	np->tf->eax = 0;
 
-	for (i = 0; i < NOFILE; i++)
-		if (curproc->ofile[i])
-			np->ofile[i] = filedup(curproc->ofile[i]);
 	np->cwd = inode_dup(curproc->cwd);
 
 	__safestrcpy(np->name, curproc->name, sizeof(curproc->name));
@@ -266,7 +674,12 @@ fork(void)
 
 	acquire(&ptable.lock);
 
-	np->state = RUNNABLE;
+	// The child starts out level with the processes
+	// that are waiting, behind those owed more.
+	np->nice = curproc->nice;
+	np->cpu = runq_idlest();
+	np->vruntime = runq[np->cpu].min_vruntime + sched_gran;
+	setrunnable(np);
 
 	release(&ptable.lock);
 
@@ -281,21 +694,16 @@ exit(int status)
 {
 	struct proc *curproc = myproc();
 	struct proc *p;
-	int fd;
 
 	if (curproc == initproc)
 		panic("init exiting");
 
 	// Close all open files.
-	for (fd = 0; fd < NOFILE; fd++) {
-		if (curproc->ofile[fd]) {
-			fileclose(curproc->ofile[fd]);
-			curproc->ofile[fd] = 0;
-		}
-	}
+	fd_closeall();
 
 	begin_op();
 	inode_put(curproc->cwd);
+	vmareas_put(curproc->vmareas);
 	end_op();
 	curproc->cwd = 0;
 	curproc->status = status;
@@ -303,19 +711,23 @@ exit(int status)
 	acquire(&ptable.lock);
 
 	// Parent might be sleeping in wait().
-	wakeup1(curproc->parent);
+	wakeup(curproc->parent);
 
 	// Pass abandoned children to init.
 	for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
 		if (p->parent == curproc) {
 			p->parent = initproc;
 			if (p->state == ZOMBIE)
-				wakeup1(initproc);
+				wakeup(initproc);
 		}
 	}
 
-	// Jump into the scheduler, never to return.
+	// Jump into the scheduler, never to return. Our parent
+	// can see that we are a zombie as soon as ptable.lock
+	// goes, but not free our stack until we are off it.
+	runq_acquire(&runq[curproc->cpu]);
 	curproc->state = ZOMBIE;
+	release(&ptable.lock);
 	sched();
 	panic("zombie exit");
 }
@@ -339,7 +751,9 @@ wait(int *wstatus)
 				continue;
 			havekids = 1;
 			if (p->state == ZOMBIE) {
-				// Found one.
+				// Found one. Wait for its CPU to switch away from it.
+				acquire(&runq[p->cpu].lock);
+				release(&runq[p->cpu].lock);
 				if (wstatus != NULL)
 					*wstatus = W_EXITCODE(p->status, p->last_signal);
 				pid = p->pid;
@@ -367,7 +781,7 @@ wait(int *wstatus)
 			return -ECHILD;
 		}
 
-		// Wait for children to exit.  (See wakeup1 call in proc_exit.)
+		// Wait for children to exit.  (See wakeup call in exit.)
 		sleep(curproc, &ptable.lock); //DOC: wait-sleep
 	}
 }
@@ -398,44 +812,61 @@ void
 scheduler(void)
 {
 	struct proc *p;
-	int ran = 0;
 	struct cpu *c = mycpu();
+	int id = c - cpus;
+	struct runq *rq = &runq[id];
 	c->proc = 0;
 
 	for (;;) {
 		// Enable interrupts on this processor.
 		sti();
 
-		// Loop over process table looking for process to run.
-		acquire(&ptable.lock);
-		for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-			if (p->state != RUNNABLE)
+		runq_acquire(rq);
+		if ((p = runq_pop(rq)) == NULL) {
+			release(&rq->lock);
+			p = runq_steal(id);
+			if (p == NULL) {
+				// Nothing to run: zero some pages for later, or sleep
+				// until the next interrupt once there are enough.
+				rq->stats.idle++;
+				if (kpage_zero_idle() == 0)
+					idle(rq);
 				continue;
-
-			// Switch to chosen process.  It is the process's job
-			// to release ptable.lock and then reacquire it
-			// before jumping back to us.
-			ran = 1;
-			c->proc = p;
-			switchuvm(p);
-			p->state = RUNNING;
-
-			swtch(&(c->scheduler), p->context);
-			switchkvm();
-
-			// Process is done running for now.
-			// It should have changed its p->state before coming back.
-			c->proc = 0;
-		}
-		release(&ptable.lock);
-		if (ran == 0) {
-			hlt();
+			}
+			runq_acquire(rq);
 		}
+
+		// Switch to chosen process.  It is the process's job
+		// to release rq->lock and then reacquire it (or the
+		// lock of whichever CPU it is on by then) before
+		// jumping back to us.
+		rq->stats.switches++;
+		p->cpu = id;
+		p->nswitch++;
+		p->lastrun = rdtsc();
+		c->proc = p;
+		rq->curr = p;
+		rq->resched = 0;
+		switchuvm(p);
+		p->state = RUNNING;
+
+		swtch(&(c->scheduler), p->context);
+		switchkvm();
+
+		// Process is done running for now.
+		// It should have changed its p->state before coming back.
+		c->proc = 0;
+		rq->curr = 0;
+		runq_update_min(rq);
+		release(&rq->lock);
 	}
 }
 
-// Enter scheduler.  Must hold only ptable.lock
-// and have changed proc->state. Saves and restores
+// Enter scheduler.  Must hold only the run queue lock of
+// this CPU and have changed proc->state; proc goes back on
+// the queue if it is RUNNABLE. Returns with the run queue
+// lock of the CPU that next runs proc held.
+// Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
 // be proc->intena and proc->ncli, but that would
@@ -447,14 +878,17 @@ sched(void)
 	int intena;
 	struct proc *p = myproc();
 
-	if (!holding(&ptable.lock))
-		panic("sched ptable.lock");
+	if (!holding(&runq[p->cpu].lock))
+		panic("sched runq lock");
 	if (mycpu()->ncli != 1)
 		panic("sched locks");
 	if (p->state == RUNNING)
 		panic("sched running");
 	if (readeflags() & FL_IF)
 		panic("sched interruptible");
+	update_curr(p);
+	if (p->state == RUNNABLE)
+		runq_push(&runq[p->cpu], p);
 	intena = mycpu()->intena;
 	swtch(&p->context, mycpu()->scheduler);
 	mycpu()->intena = intena;
@@ -464,10 +898,96 @@ sched(void)
 void
 yield(void)
 {
-	acquire(&ptable.lock); //DOC: yieldlock
-	myproc()->state = RUNNABLE;
+	struct proc *p = myproc();
+
+	// Interrupts off, so that p->cpu stays put until we hold its lock.
+	pushcli();
+	runq_acquire(&runq[p->cpu]); //DOC: yieldlock
+	popcli();
+	p->state = RUNNABLE;
 	sched();
+	release(&runq[p->cpu].lock);
+}
+
+// Called on the way out of every trap taken by a running
+// process. Gives up the CPU if a process that woke up on this
+// CPU should run first or, on a timer tick, if this one has
+// had its share.
+void
+preempt(int tick)
+{
+	struct proc *p = myproc();
+	struct runq *rq;
+	uint64_t gran = tick ? sched_gran : 0;
+
+	pushcli();
+	rq = &runq[p->cpu];
+	if (!tick && !__atomic_load_n(&rq->resched, __ATOMIC_RELAXED)) {
+		popcli();
+		return;
+	}
+	runq_acquire(rq);
+	popcli();
+	rq->resched = 0;
+	update_curr(p);
+	if (rq->head == NULL || rq->head->vruntime + gran >= p->vruntime) {
+		release(&rq->lock);
+		return;
+	}
+	rq->stats.preempts++;
+	p->state = RUNNABLE;
+	sched();
+	release(&runq[p->cpu].lock);
+}
+
+// Set the nice value of process pid (0 for the caller)
+// to nice. Only root may lower it, or change another
+// user's processes.
+int
+setnice(pid_t pid, int nice)
+{
+	struct proc *curproc = myproc(), *p;
+
+	if (nice < NICE_MIN || nice > NICE_MAX)
+		return -EINVAL;
+	acquire(&ptable.lock);
+	for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+		if (p->state == UNUSED || p->state == ZOMBIE ||
+				p->pid != (pid ? pid : curproc->pid))
+			continue;
+		if (curproc->cred.uid != 0 && p->cred.uid != curproc->cred.uid) {
+			release(&ptable.lock);
+			return -EPERM;
+		}
+		if (curproc->cred.uid != 0 && nice < p->nice) {
+			release(&ptable.lock);
+			return -EACCES;
+		}
+		p->nice = nice;
+		release(&ptable.lock);
+		return 0;
+	}
 	release(&ptable.lock);
+	return -ESRCH;
+}
+
+// The nice value of process pid (0 for the caller).
+int
+getnice(pid_t pid, int *nice)
+{
+	struct proc *curproc = myproc(), *p;
+
+	acquire(&ptable.lock);
+	for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+		if (p->state != UNUSED && p->state != ZOMBIE &&
+				p->pid == (pid ? pid : curproc->pid)) {
+			*nice = p->nice;
+			release(&ptable.lock);
+			return 0;
+		}
+	}
+	release(&ptable.lock);
+	return -ESRCH;
 }
 
 // A fork child's very first scheduling by scheduler()
@@ -476,8 +996,8 @@ void
 forkret(void)
 {
 	static int first = 1;
-	// Still holding ptable.lock from scheduler.
-	release(&ptable.lock);
+	// Still holding this CPU's run queue lock from scheduler.
+	release(&runq[myproc()->cpu].lock);
 
 	if (first) {
 		// Some initialization functions must be run in the context
@@ -486,6 +1006,7 @@ forkret(void)
 		first = 0;
 		inode_init(ROOTDEV);
 		initlog(ROOTDEV);
+		block_index_init(ROOTDEV);
 	}
 
 	// Return to "caller", actually trapret (see allocproc).
@@ -497,6 +1018,7 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
 	struct proc *p = myproc();
+	struct waitq *wq;
 
 	if (p == 0)
 		panic("sleep");
@@ -504,51 +1026,69 @@ sleep(void *chan, struct spinlock *lk)
 	if (lk == 0)
 		panic("sleep without lk");
 
-	// Must acquire ptable.lock in order to
+	// Must acquire the wait queue lock in order to
 	// change p->state and then call sched.
-	// Once we hold ptable.lock, we can be
-	// guaranteed that we won't miss any wakeup
-	// (wakeup runs with ptable.lock locked),
-	// so it's okay to release lk.
-	if (lk != &ptable.lock) { //DOC: sleeplock0
-		acquire(&ptable.lock); //DOC: sleeplock1
-		release(lk);
-	}
-	// Go to sleep.
+	// Once we hold it, we can be guaranteed that
+	// we won't miss any wakeup (wakeup runs with
+	// it locked), so it's okay to release lk.
+	wq = waitq_of(chan);
+	acquire(&wq->lock); //DOC: sleeplock1
+	release(lk);
+
+	// Go to sleep. A wakeup that comes once wq->lock
+	// is released queues us on this CPU, so has to wait
+	// for its run queue lock until we are switched out.
 	p->chan = chan;
 	p->state = SLEEPING;
+	p->wq_prev = NULL;
+	p->wq_next = wq->head;
+	if (wq->head)
+		wq->head->wq_prev = p;
+	wq->head = p;
+	runq_acquire(&runq[p->cpu]);
+	release(&wq->lock);
 
 	sched();
 
-	// Tidy up.
-	p->chan = 0;
+	release(&runq[p->cpu].lock);
 
 	// Reacquire original lock.
-	if (lk != &ptable.lock) { //DOC: sleeplock2
-		release(&ptable.lock);
-		acquire(lk);
-	}
+	acquire(lk); //DOC: sleeplock2
 }
 
-// Wake up all processes sleeping on chan.
-// The ptable lock must be held.
+// Make p, which is SLEEPING on wq, RUNNABLE.
+// Caller holds wq->lock.
 static void
-wakeup1(void *chan)
+wake(struct waitq *wq, struct proc *p)
 {
-	struct proc *p;
-
-	for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-		if (p->state == SLEEPING && p->chan == chan)
-			p->state = RUNNABLE;
+	waitq_remove(wq, p);
+	p->chan = 0;
+	setrunnable(p);
 }
 
 // Wake up all processes sleeping on chan.
 void
 wakeup(void *chan)
 {
-	acquire(&ptable.lock);
-	wakeup1(chan);
-	release(&ptable.lock);
+	struct waitq *wq = waitq_of(chan);
+	struct sched_cpu_stats *st;
+	struct proc *p, *next;
+	uint64_t scanned = 0, woken = 0;
+
+	acquire(&wq->lock);
+	for (p = wq->head; p != NULL; p = next) {
+		next = p->wq_next;
+		scanned++;
+		if (p->chan == chan) {
+			wake(wq, p);
+			woken++;
+		}
+	}
+	st = &runq[my_cpu_id()].stats;
+	st->wakeups++;
+	st->woken += woken;
+	st->wait_scanned += scanned;
+	release(&wq->lock);
 }
 
 static void
@@ -574,6 +1114,7 @@ int
 kill(pid_t pid, int signal)
 {
 	struct proc *p;
+	void *chan;
 
 	acquire(&ptable.lock);
 	for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
@@ -586,8 +1127,13 @@ kill(pid_t pid, int signal)
 			}
 			p->last_signal = signal;
 			// Wake process from sleep if necessary.
-			if (p->state == SLEEPING)
-				p->state = RUNNABLE;
+			if ((chan = p->chan) != NULL) {
+				struct waitq *wq = waitq_of(chan);
+				acquire(&wq->lock);
+				if (p->state == SLEEPING && p->chan == chan)
+					wake(wq, p);
+				release(&wq->lock);
+			}
 			release(&ptable.lock);
 			return 0;
 		}
@@ -8,6 +8,14 @@ pub unsafe fn outb(value: u8, port: u16) {
         options(att_syntax));
 }
 
+pub unsafe fn outw(value: u16, port: u16) {
+    asm!(
+        "outw %ax, %dx",
+        in("ax") value,
+        in("dx") port,
+        options(att_syntax));
+}
+
 pub unsafe fn outl(value: u32, port: u16) {
     asm!(
         "outl %eax, %dx",
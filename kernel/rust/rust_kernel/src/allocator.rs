@@ -1,4 +1,4 @@
-use bindings::kalloc::{kfree, kmalloc};
+use bindings::kalloc::{kfree, kmalloc_align};
 use core::alloc::{GlobalAlloc, Layout};
 use core::ffi::c_void;
 
@@ -6,7 +6,7 @@ pub struct KernelAllocator;
 
 unsafe impl GlobalAlloc for KernelAllocator {
     unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
-        unsafe { kmalloc(layout.size()) as *mut u8 }
+        unsafe { kmalloc_align(layout.size(), layout.align()) as *mut u8 }
     }
     unsafe fn dealloc(&self, ptr: *mut u8, _layout: Layout) {
         unsafe {
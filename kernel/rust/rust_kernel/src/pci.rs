@@ -1,6 +1,6 @@
 // https://wiki.osdev.org/PCI
 use crate::printing::*;
-use bindings::x86::{inl, outl};
+use bindings::x86::{inl, outl, outw};
 use alloc::vec::Vec;
 use spin::Mutex;
 const CONFIG_ADDRESS: u16 = 0xCF8;
@@ -174,29 +174,31 @@ impl PCICommonHeader {
     }
 }
 
-// Read a "word" from the PCI config. A "word" is 16 bits.
-// An "offset" is 8 bits.
-// That means that "offset 2" will give back bits [16, 31].
-fn pci_config_read_word((bus, slot, func): (u8, u8, u8), offset: u8) -> u16 {
-    // Address to send through the port.
-    // 7-0 = register offset, but [1, 0] is always 0
-    // 10-8 = function number
-    // 15-11 = device number
-    // 23-16 = bus number
-    // 30-24 reserved
-    // 31 - enable
-    let address = ((bus as u32) << 16)
+// Address to send through the port.
+// 7-0 = register offset, but [1, 0] is always 0
+// 10-8 = function number
+// 15-11 = device number
+// 23-16 = bus number
+// 30-24 reserved
+// 31 - enable
+fn pci_config_address((bus, slot, func): (u8, u8, u8), offset: u8) -> u32 {
+    ((bus as u32) << 16)
         | ((slot as u32) << 11)
         | ((func as u32) << 8)
         | ((offset & 0xFC) as u32)
-        | (1u32 << 31);
+        | (1u32 << 31)
+}
 
+// Read a "word" from the PCI config. A "word" is 16 bits.
+// An "offset" is 8 bits.
+// That means that "offset 2" will give back bits [16, 31].
+fn pci_config_read_word(tuple: (u8, u8, u8), offset: u8) -> u16 {
     /*
      * SAFETY: we trust the system integrator here that the ports return what
      * the spec says that they should. This might not always be the case.
      */
     unsafe {
-        outl(address, CONFIG_ADDRESS);
+        outl(pci_config_address(tuple, offset), CONFIG_ADDRESS);
     }
     unsafe { ((inl(CONFIG_DATA) >> ((offset & 2) * 8)) & 0xFFFF) as u16 }
 }
@@ -206,7 +208,20 @@ fn pci_config_read_word((bus, slot, func): (u8, u8, u8), offset: u8) -> u16 {
  */
 fn pci_config_read_long(tuple: (u8, u8, u8), offset: u8) -> u32 {
     pci_config_read_word(tuple, offset) as u32
-        & (pci_config_read_word(tuple, offset+2) as u32) << 16
+        | (pci_config_read_word(tuple, offset + 2) as u32) << 16
+}
+
+/*
+ * Write a "word" without touching its neighbour, which matters
+ * for the command register: the status register next to it
+ * clears bits that are written as 1.
+ */
+fn pci_config_write_word(tuple: (u8, u8, u8), offset: u8, value: u16) {
+    // SAFETY: see pci_config_read_word().
+    unsafe {
+        outl(pci_config_address(tuple, offset), CONFIG_ADDRESS);
+        outw(value, CONFIG_DATA + (offset & 2) as u16);
+    }
 }
 
 fn pci_get_vendor_id(tuple: (u8, u8, u8)) -> Option<u16> {
@@ -320,6 +335,20 @@ pub extern "C" fn pci_get_conf() -> FatPointerArray_pci_conf {
     FatPointerArray_pci_conf { ptr, len }
 }
 
+/*
+ * Config space access for drivers that need more than
+ * struct pci_conf carries, such as BARs.
+ */
+#[unsafe(no_mangle)]
+pub extern "C" fn pci_config_read32(bus: u8, device: u8, function: u8, offset: u8) -> u32 {
+    pci_config_read_long((bus, device, function), offset)
+}
+
+#[unsafe(no_mangle)]
+pub extern "C" fn pci_config_write16(bus: u8, device: u8, function: u8, offset: u8, value: u16) {
+    pci_config_write_word((bus, device, function), offset, value)
+}
+
 /*
  * Currently, these do not get added to any structure. They just get printed.
  */
@@ -0,0 +1,382 @@
+// Slab allocator.
+//
+// Small kernel objects come from caches of equal-sized objects.
+// A cache keeps its objects in slabs of one page frame each, with
+// a struct slab at the start of the page and the objects after it,
+// so an object's slab is found by rounding its address down to a
+// page boundary and objects need no header of their own. Slabs
+// with free objects are on the cache's partial list, under the
+// cache's lock.
+//
+// In front of the slabs, each CPU has a magazine of up to SLAB_MAG
+// free objects per cache, which it uses with interrupts off and no
+// lock; it only takes the cache's lock to refill an empty magazine
+// or drain a full one, half a magazine at a time.
+//
+// kmalloc() serves requests of up to SLAB_MAXCLASS bytes from
+// caches of power-of-two sizes, whose objects are aligned to their
+// size, and larger ones with blocks of pages from kpages_alloc().
+// Objects from a cache never start on a page boundary, which is
+// how kfree() tells the two apart.
+
+#include <stdint.h>
+#include <string.h>
+#include "param.h"
+#include "spinlock.h"
+#include "console.h"
+#include "kalloc.h"
+#include "slab.h"
+#include "proc.h"
+#include "macros.h"
+#include "ioctl.h"
+#include "drivers/mmu.h"
+
+#define SLAB_MAGIC 0x51ab51abU
+#define SLAB_MAG 14 // objects in a CPU's magazine
+#define SLAB_MINCLASS 16
+#define SLAB_MAXCLASS 1024
+#define SLAB_NCLASS 7 // 16, 32, ..., 1024
+
+struct slab {
+	uint32_t magic;
+	uint32_t inuse; // objects handed out
+	struct slab_cache *cache;
+	struct slab *prev, *next; // on the cache's partial list
+	void *free; // free objects, linked through their first word
+};
+
+struct slab_mag {
+	uint32_t n;
+	uint64_t allocs, frees;
+	void *obj[SLAB_MAG];
+};
+
+struct slab_cache {
+	char name[16];
+	uint32_t size; // bytes per object, a multiple of align
+	uint32_t align;
+	uint32_t offset; // of the first object in a slab
+	uint32_t perslab; // objects in a slab
+	int nomag; // no magazines; every call takes the lock
+	struct spinlock lock;
+	struct slab *partial; // slabs with free objects
+	uint32_t npages;
+	uint32_t nempty; // slabs on partial with no objects in use
+	uint64_t allocs, frees; // not counting those through magazines
+	struct slab_mag *mag[NCPU];
+};
+
+static const char *class_names[SLAB_NCLASS] = {
+	"kmalloc-16",  "kmalloc-32",	"kmalloc-64",		"kmalloc-128",
+	"kmalloc-256", "kmalloc-512", "kmalloc-1024",
+};
+
+static struct {
+	struct spinlock lock;
+	struct slab_cache cache[NSLABSTATS];
+	int ncache;
+	struct slab_cache *mags; // holds the magazines
+	struct slab_cache *classes[SLAB_NCLASS];
+} slab;
+
+static struct slab_cache *
+cache_setup(const char *name, size_t size, size_t align, int nomag)
+{
+	struct slab_cache *c;
+
+	acquire(&slab.lock);
+	if (slab.ncache == NSLABSTATS)
+		panic("slab_cache_create");
+	c = &slab.cache[slab.ncache++];
+	release(&slab.lock);
+
+	align = max(align, sizeof(void *));
+	if (align & (align - 1))
+		panic("slab_cache_create: align");
+	strncpy(c->name, name, sizeof(c->name) - 1);
+	c->align = align;
+	c->size = (max(size, sizeof(void *)) + align - 1) & ~(align - 1);
+	c->offset = (sizeof(struct slab) + align - 1) & ~(align - 1);
+	if (c->offset + c->size > PGSIZE)
+		panic("slab_cache_create: size");
+	c->perslab = (PGSIZE - c->offset) / c->size;
+	c->nomag = nomag;
+	initlock(&c->lock, c->name);
+	return c;
+}
+
+void
+slab_init(void)
+{
+	initlock(&slab.lock, "slab");
+	slab.mags = cache_setup("slab-mag", sizeof(struct slab_mag), 0, 1);
+	for (int i = 0; i < SLAB_NCLASS; i++)
+		slab.classes[i] = cache_setup(class_names[i], SLAB_MINCLASS << i,
+																	SLAB_MINCLASS << i, 0);
+}
+
+// Make a cache of objects of size bytes aligned to align,
+// a power of two (0 for pointer alignment).
+struct slab_cache *
+slab_cache_create(const char *name, size_t size, size_t align)
+{
+	return cache_setup(name, size, align, 0);
+}
+
+static void
+slab_link(struct slab_cache *c, struct slab *s)
+{
+	s->prev = 0;
+	s->next = c->partial;
+	if (c->partial)
+		c->partial->prev = s;
+	c->partial = s;
+}
+
+static void
+slab_unlink(struct slab_cache *c, struct slab *s)
+{
+	if (s->prev)
+		s->prev->next = s->next;
+	else
+		c->partial = s->next;
+	if (s->next)
+		s->next->prev = s->prev;
+}
+
+// Caller holds c->lock.
+static struct slab *
+slab_new(struct slab_cache *c)
+{
+	char *page;
+	struct slab *s;
+
+	if ((page = kpage_alloc()) == 0)
+		return 0;
+	s = (struct slab *)page;
+	s->magic = SLAB_MAGIC;
+	s->inuse = 0;
+	s->cache = c;
+	s->free = 0;
+	for (uint32_t i = c->perslab; i-- > 0;) {
+		void **obj = (void **)(page + c->offset + i * c->size);
+		*obj = s->free;
+		s->free = obj;
+	}
+	slab_link(c, s);
+	c->npages++;
+	c->nempty++;
+	return s;
+}
+
+// Take a free object from c's slabs. Caller holds c->lock.
+static void *
+slab_take(struct slab_cache *c)
+{
+	struct slab *s;
+	void *obj;
+
+	if ((s = c->partial) == 0 && (s = slab_new(c)) == 0)
+		return 0;
+	if (s->inuse++ == 0)
+		c->nempty--;
+	obj = s->free;
+	s->free = *(void **)obj;
+	if (s->free == 0)
+		slab_unlink(c, s);
+	return obj;
+}
+
+static struct slab *
+slab_of(void *obj)
+{
+	return (struct slab *)PGROUNDDOWN((uintptr_t)obj);
+}
+
+// Give obj back to its slab, and the slab's page back if
+// the cache has another empty slab. Caller holds c->lock.
+static void
+slab_put(struct slab_cache *c, void *obj)
+{
+	struct slab *s = slab_of(obj);
+
+	if (s->magic != SLAB_MAGIC || s->cache != c || s->inuse == 0)
+		panic("slab_free");
+	if (s->free == 0)
+		slab_link(c, s);
+	*(void **)obj = s->free;
+	s->free = obj;
+	if (--s->inuse > 0)
+		return;
+	if (c->nempty > 0) {
+		slab_unlink(c, s);
+		s->magic = 0;
+		c->npages--;
+		kpage_free((char *)s);
+	} else {
+		c->nempty++;
+	}
+}
+
+// This CPU's magazine for c, or 0 if it has none and can't
+// get one. Caller has interrupts off.
+static struct slab_mag *
+slab_mag(struct slab_cache *c)
+{
+	int id = my_cpu_id();
+
+	if (c->nomag)
+		return 0;
+	if (c->mag[id] == 0 && (c->mag[id] = slab_alloc(slab.mags)) != 0)
+		memset(c->mag[id], 0, sizeof(struct slab_mag));
+	return c->mag[id];
+}
+
+void *
+slab_alloc(struct slab_cache *c)
+{
+	struct slab_mag *m;
+	void *obj;
+
+	pushcli();
+	if ((m = slab_mag(c)) == 0) {
+		acquire(&c->lock);
+		if ((obj = slab_take(c)) != 0)
+			c->allocs++;
+		release(&c->lock);
+		popcli();
+		return obj;
+	}
+	if (m->n == 0) {
+		acquire(&c->lock);
+		while (m->n < SLAB_MAG / 2 && (obj = slab_take(c)) != 0)
+			m->obj[m->n++] = obj;
+		release(&c->lock);
+	}
+	obj = 0;
+	if (m->n > 0) {
+		obj = m->obj[--m->n];
+		m->allocs++;
+	}
+	popcli();
+	return obj;
+}
+
+void
+slab_free(struct slab_cache *c, void *obj)
+{
+	struct slab_mag *m;
+
+	pushcli();
+	if ((m = slab_mag(c)) == 0) {
+		acquire(&c->lock);
+		slab_put(c, obj);
+		c->frees++;
+		release(&c->lock);
+		popcli();
+		return;
+	}
+	if (m->n == SLAB_MAG) {
+		acquire(&c->lock);
+		for (int i = 0; i < SLAB_MAG / 2; i++)
+			slab_put(c, m->obj[i]);
+		release(&c->lock);
+		memmove(m->obj, m->obj + SLAB_MAG / 2,
+						(SLAB_MAG - SLAB_MAG / 2) * sizeof(m->obj[0]));
+		m->n -= SLAB_MAG / 2;
+	}
+	m->obj[m->n++] = obj;
+	m->frees++;
+	popcli();
+}
+
+// Fill st[0..NSLABSTATS) with the usage of each cache.
+void
+slab_get_stats(struct slab_stats *st)
+{
+	memset(st, 0, NSLABSTATS * sizeof(*st));
+	for (int i = 0; i < slab.ncache; i++) {
+		struct slab_cache *c = &slab.cache[i];
+
+		strncpy(st[i].name, c->name, sizeof(st[i].name) - 1);
+		st[i].size = c->size;
+		st[i].pages = c->npages;
+		st[i].objects = c->npages * c->perslab;
+		st[i].allocs = c->allocs;
+		st[i].frees = c->frees;
+		for (int j = 0; j < min(NCPU, ncpu); j++) {
+			if (c->mag[j]) {
+				st[i].allocs += c->mag[j]->allocs;
+				st[i].frees += c->mag[j]->frees;
+			}
+		}
+		st[i].inuse = st[i].allocs - st[i].frees;
+	}
+}
+
+// Allocate size bytes aligned to align, a power of two.
+void *
+kmalloc_align(size_t size, size_t align)
+{
+	size_t n = max(size, align);
+
+	for (int i = 0; i < SLAB_NCLASS; i++) {
+		if (n <= (size_t)SLAB_MINCLASS << i)
+			return slab_alloc(slab.classes[i]);
+	}
+	return kpages_alloc(kpages_order(n));
+}
+
+void *
+kmalloc(size_t size)
+{
+	return kmalloc_align(size, 1);
+}
+
+// How many bytes the allocation at p can hold.
+static size_t
+ksize(void *p)
+{
+	if ((uintptr_t)p % PGSIZE == 0)
+		return (size_t)PGSIZE << kpage_order(p);
+	return slab_of(p)->cache->size;
+}
+
+void
+kfree(void *p)
+{
+	struct slab *s;
+
+	if ((uintptr_t)p % PGSIZE == 0) {
+		kpage_free(p);
+		return;
+	}
+	s = slab_of(p);
+	if (s->magic != SLAB_MAGIC)
+		panic("kfree");
+	slab_free(s->cache, p);
+}
+
+void *
+krealloc(void *ptr, size_t size)
+{
+	void *newptr;
+
+	if (size <= ksize(ptr))
+		return ptr;
+	if ((newptr = kmalloc(size)) == NULL)
+		return NULL;
+	memcpy(newptr, ptr, ksize(ptr));
+	kfree(ptr);
+	return newptr;
+}
+
+void *
+kcalloc(size_t size)
+{
+	void *ptr = kmalloc(size);
+	if (ptr == NULL)
+		return NULL;
+	memset(ptr, '\0', size);
+	return ptr;
+}
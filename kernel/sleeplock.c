@@ -25,6 +25,22 @@ acquiresleep(struct sleeplock *lk)
 	release(&lk->lk);
 }
 
+// Take lk if nobody holds it. Returns 1 if it was taken.
+int
+tryacquiresleep(struct sleeplock *lk)
+{
+	int r;
+
+	acquire(&lk->lk);
+	r = !lk->locked;
+	if (r) {
+		lk->locked = 1;
+		lk->pid = myproc()->pid;
+	}
+	release(&lk->lk);
+	return r;
+}
+
 void
 releasesleep(struct sleeplock *lk)
 {
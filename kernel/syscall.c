@@ -9,6 +9,7 @@
 #include "x86.h"
 #include "syscall.h"
 #include "console.h"
+#include "vm.h"
 
 #define SYSCALL_ARG_FETCH(T) \
 int \
@@ -17,6 +18,8 @@ fetch ## T(uintptr_t addr, T *ip) \
 	struct proc *curproc = myproc(); \
 	if (addr >= curproc->sz || addr + sizeof(T) > curproc->sz) \
 		return -1; \
+	if (uvm_prefault(curproc, addr, sizeof(T), 0) < 0) \
+		return -1; \
 	*ip = *(T *)(addr); \
 	return 0; \
 }
@@ -48,6 +51,11 @@ fetchstr(uintptr_t addr, char **pp)
 	*pp = (char *)addr;
 	ep = (char *)curproc->sz;
 	for (s = *pp; s < ep; s++) {
+		// Fault each page in before reading it, as argptr() does.
+		// Some callers write to the string, so split it too.
+		if ((s == *pp || (uintptr_t)s % PGSIZE == 0) &&
+				uvm_prefault(curproc, (uintptr_t)s, 1, 1) < 0)
+			return -1;
 		if (s != NULL && *s == 0)
 			return s - *pp;
 	}
@@ -108,6 +116,11 @@ argptr(int n, char **pp, int size)
 		((uintptr_t)ptr >= curproc->effective_largest_sz || (uintptr_t)ptr + size > curproc->effective_largest_sz)) {
 		return -1;
 	}
+	// Callers may touch the buffer with spinlocks held,
+	// where a fault could not wait for the disk, and may
+	// write to it, where a fault could not fail.
+	if (uvm_prefault(curproc, ptr, size, 1) < 0)
+		return -1;
 	*pp = (char *)ptr;
 	return 0;
 }
@@ -199,6 +212,16 @@ extern size_t
 sys_signal(void);
 extern size_t
 sys_getcwd(void);
+extern size_t
+sys_fsstat(void);
+extern size_t
+sys_getpriority(void);
+extern size_t
+sys_setpriority(void);
+extern size_t
+sys_nanosleep(void);
+extern size_t
+sys_clock_gettime(void);
 
 static size_t (*syscalls[])(void) = {
 	[SYS_fork] = sys_fork,				 [SYS__exit] = sys__exit,
@@ -219,7 +242,9 @@ static size_t (*syscalls[])(void) = {
 	[SYS_fsync] = sys_fsync,			 [SYS_writev] = sys_writev,
 	[SYS_ioctl] = sys_ioctl,			 [SYS_mmap] = sys_mmap,
 	[SYS_munmap] = sys_munmap,		 [SYS_signal] = sys_signal,
-	[SYS_getcwd] = sys_getcwd,
+	[SYS_getcwd] = sys_getcwd,		 [SYS_fsstat] = sys_fsstat,
+	[SYS_getpriority] = sys_getpriority, [SYS_setpriority] = sys_setpriority,
+	[SYS_nanosleep] = sys_nanosleep, [SYS_clock_gettime] = sys_clock_gettime,
 };
 
 void
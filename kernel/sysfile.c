@@ -12,6 +12,7 @@
 #include <stat.h>
 #include <stdlib.h>
 #include <sys/uio.h>
+#include <sys/fsstat.h>
 #include <dirent.h>
 #include <date.h>
 #include <time.h>
@@ -25,15 +26,20 @@
 #include "file.h"
 #include "console.h"
 #include "log.h"
+#include "dcache.h"
 #include "syscall.h"
 #include "pipe.h"
 #include "exec.h"
 #include "ioctl.h"
+#include "ide.h"
+#include "bio.h"
 #include "kalloc.h"
+#include "slab.h"
 #include "mman.h"
 #include <string.h>
 #include "drivers/lapic.h"
 #include "vm.h"
+#include "timeout.h"
 
 static struct inode *
 link_dereference(struct inode *ip, char *buff);
@@ -47,10 +53,8 @@ argfd(int n, int *pfd, struct file **pf)
 
 	if (argint(n, &fd) < 0)
 		return -EINVAL;
-	if (fd < 0 || (f = myproc()->ofile[fd]) == 0)
+	if ((f = fd_to_struct_file(fd)) == 0)
 		return -EBADF;
-	if (fd >= NOFILE)
-		return -ENFILE;
 	if (pfd)
 		*pfd = fd;
 	if (pf)
@@ -58,23 +62,6 @@ argfd(int n, int *pfd, struct file **pf)
 	return 0;
 }
 
-// Allocate a file descriptor for the given file.
-// Takes over file reference from caller on success.
-static int
-fdalloc(struct file *f)
-{
-	int fd;
-	struct proc *curproc = myproc();
-
-	for (fd = 0; fd < NOFILE; fd++) {
-		if (curproc->ofile[fd] == 0) {
-			curproc->ofile[fd] = f;
-			return fd;
-		}
-	}
-	return -1;
-}
-
 size_t
 sys_dup(void)
 {
@@ -83,8 +70,8 @@ sys_dup(void)
 
 	if (argfd(0, 0, &f) < 0)
 		return -1;
-	if ((fd = fdalloc(f)) < 0)
-		return -EBADF;
+	if ((fd = fd_alloc(f)) < 0)
+		return fd;
 	filedup(f);
 	return fd;
 }
@@ -143,7 +130,7 @@ sys_close(void)
 
 	if (argfd(0, &fd, &f) < 0)
 		return -EINVAL;
-	myproc()->ofile[fd] = 0;
+	fd_clear(fd);
 	fileclose(f);
 	return 0;
 }
@@ -235,7 +222,6 @@ size_t
 sys_unlink(void)
 {
 	struct inode *ip, *dp;
-	struct dirent de;
 	char name[DIRSIZ], *path;
 	uint64_t off;
 	int error = EINVAL;
@@ -270,9 +256,7 @@ sys_unlink(void)
 		goto bad;
 	}
 
-	memset(&de, 0, sizeof(de));
-	if (inode_write(dp, (char *)&de, off, sizeof(de)) != sizeof(de))
-		panic("unlink: inode_write");
+	dirunlink(dp, off);
 	if (S_ISDIR(ip->mode)) {
 		dp->nlink--;
 		inode_update(dp);
@@ -413,7 +397,7 @@ fileopen(char *path, mode_t omode)
 	// That is why it is released down here.
 get_fd:
 
-	if ((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0) {
+	if ((f = filealloc()) == 0 || (fd = fd_alloc(f)) < 0) {
 		if (f)
 			fileclose(f);
 		inode_unlockput(ip);
@@ -428,6 +412,7 @@ get_fd:
 	f->off = (omode & O_APPEND) == O_APPEND ? f->ip->size : 0;
 	f->readable = !(omode & O_WRONLY);
 	f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+	f->sync = (omode & (O_SYNC | O_DSYNC)) != 0;
 	return fd;
 }
 
@@ -517,8 +502,11 @@ sys_getcwd(void)
 	if (argstr(0, &buf) < 0 || argsize_t(1, &size) < 0)
 		return -EINVAL;
 
-	// Translate cwd from inode into path.
+	// Translate cwd from inode into path. The walk puts the
+	// inodes it gets, so it must be in a transaction.
+	begin_op();
 	char *ret = inode_to_path(buf, size, myproc()->cwd);
+	end_op();
 	// If we are negative, propogate the errno.
 	if (ret == NULL)
 		return -EINVAL;
@@ -577,9 +565,9 @@ sys_pipe(void)
 	if (pipealloc(&rf, &wf) < 0)
 		return -EINVAL;
 	fd0 = -1;
-	if ((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0) {
+	if ((fd0 = fd_alloc(rf)) < 0 || (fd1 = fd_alloc(wf)) < 0) {
 		if (fd0 >= 0)
-			myproc()->ofile[fd0] = 0;
+			fd_clear(fd0);
 		fileclose(rf);
 		fileclose(wf);
 		return -EBADF;
@@ -779,12 +767,107 @@ sys_ioctl(void)
 		return 0;
 		break;
 	}
+	case IDEIOCSDMA: {
+		int on;
+		if (argint(2, &on) < 0)
+			return -EINVAL;
+		// It changes how every disk transfer is done.
+		if (myproc()->cred.uid != 0)
+			return -EPERM;
+		if (ide_set_dma(on) < 0)
+			return -ENODEV;
+		return 0;
+	}
+	case IDEIOCGDMA: {
+		if (argptr(2, (char **)&last_optional_arg, sizeof(int)) < 0)
+			return -EINVAL;
+		if (last_optional_arg == NULL)
+			return -EFAULT;
+		*(int *)last_optional_arg = ide_using_dma();
+		return 0;
+	}
+	case IDEIOCGSTATS: {
+		if (argptr(2, (char **)&last_optional_arg, sizeof(struct ide_stats)) < 0)
+			return -EINVAL;
+		if (last_optional_arg == NULL)
+			return -EFAULT;
+		ide_get_stats(last_optional_arg);
+		return 0;
+	}
+	case BIOIOCGSTATS: {
+		if (argptr(2, (char **)&last_optional_arg, sizeof(struct bio_stats)) < 0)
+			return -EINVAL;
+		if (last_optional_arg == NULL)
+			return -EFAULT;
+		block_get_stats(last_optional_arg);
+		return 0;
+	}
+	case SLABIOCGSTATS: {
+		if (argptr(2, (char **)&last_optional_arg,
+							 sizeof(struct slab_stats[NSLABSTATS])) < 0)
+			return -EINVAL;
+		if (last_optional_arg == NULL)
+			return -EFAULT;
+		slab_get_stats(last_optional_arg);
+		return 0;
+	}
+	case MEMIOCGSTATS: {
+		if (argptr(2, (char **)&last_optional_arg, sizeof(struct mem_stats)) < 0)
+			return -EINVAL;
+		if (last_optional_arg == NULL)
+			return -EFAULT;
+		kmem_get_stats(last_optional_arg);
+		return 0;
+	}
+	case SCHEDIOCGSTATS: {
+		if (argptr(2, (char **)&last_optional_arg, sizeof(struct sched_stats)) < 0)
+			return -EINVAL;
+		if (last_optional_arg == NULL)
+			return -EFAULT;
+		sched_get_stats(last_optional_arg);
+		return 0;
+	}
+	case PROCIOCGSTATS: {
+		if (argptr(2, (char **)&last_optional_arg,
+							 sizeof(struct proc_stats[NPROCSTATS])) < 0)
+			return -EINVAL;
+		if (last_optional_arg == NULL)
+			return -EFAULT;
+		proc_get_stats(last_optional_arg);
+		return 0;
+	}
+	case TIMERIOCGSTATS: {
+		if (argptr(2, (char **)&last_optional_arg, sizeof(struct timer_stats)) < 0)
+			return -EINVAL;
+		if (last_optional_arg == NULL)
+			return -EFAULT;
+		timeout_get_stats(last_optional_arg);
+		return 0;
+	}
 	default: {
 		return -EINVAL;
 	}
 	}
 }
 
+// Back [va, va + length) with zeroed memory of the process's
+// own, which munmap() or exit frees.
+static int
+mmap_anon(uintptr_t *pgdir, uintptr_t va, size_t length, int perm)
+{
+	for (uintptr_t a = va; a < va + length; a += PGSIZE) {
+		char *mem = kpage_alloc_zeroed();
+		if (mem != NULL && mappages(pgdir, (void *)a, PGSIZE, V2P(mem), perm) == 0)
+			continue;
+		if (mem != NULL)
+			kpage_free(mem);
+		// Free what was mapped before giving up.
+		unmapuvm(pgdir, va, a - va);
+		return -1;
+	}
+	return 0;
+}
+
 static int
 mmap_prot_to_perm(int prot)
 {
@@ -832,34 +915,47 @@ sys_mmap(void)
 	} else {
 		info = (struct mmap_info){ length, (uintptr_t)addr, 0/* virtual address */, NULL};
 	}
+	if (info.length == 0)
+		return -ENODEV;
 	struct proc *proc = myproc();
-	if (proc->mmap_count > NMMAP)
+	int slot;
+	for (slot = 0; slot < NMMAP; slot++) {
+		if (proc->mmap_info[slot].length == 0)
+			break;
+	}
+	if (slot == NMMAP)
 		return -ENOMEM;
-	// Place it anywhere.
-	if (addr == NULL) {
-		info.virt_addr = PGROUNDUP(proc->effective_largest_sz);
-		if (mappages(myproc()->pgdir, (void *)info.virt_addr,
-								 info.length, info.addr, perm) < 0) {
+	// Place it anywhere: at the same offset into a large page
+	// as the device memory, so that most of it can be mapped
+	// with large pages.
+	if (addr == NULL)
+		info.virt_addr = HUGEPGROUNDUP(proc->effective_largest_sz) +
+										 (info.addr & (HUGEPGSIZE - 1));
+	else
+		info.virt_addr = (uintptr_t)addr;
+	if (info.virt_addr + info.length > USERTOP ||
+			info.virt_addr + info.length < info.virt_addr)
+		return -ENOMEM;
+	if (info.virt_addr < proc->sz ||
+			mmap_overlaps(proc, info.virt_addr, info.length))
+		return -EINVAL;
+	// Anything but device memory, or device memory there was no
+	// memory to map, gets memory of its own.
+	int r = -1;
+	if (info.file != NULL &&
+			(r = mapdevice(proc->pgdir, info.virt_addr, info.length, info.addr,
+										 perm)) < 0)
+		unmapuvm(proc->pgdir, info.virt_addr, info.length);
+	if (r < 0) {
+		info.addr = 0;
+		if (mmap_anon(proc->pgdir, info.virt_addr, info.length, perm) < 0)
 			return -ENOMEM;
-		}
-		myproc()->effective_largest_sz += info.length;
-		proc->mmap_info[proc->mmap_count++] = info;
-		return (size_t)info.virt_addr;
-	} else {
-		if (mappages(proc->pgdir, addr, info.length, info.addr, perm) < 0) {
-			void *ptr = kmalloc(info.length);
-			if (ptr == NULL)
-				return -ENOMEM;
-			if (mappages(proc->pgdir, addr, info.length, V2P(ptr), perm) < 0) {
-				kfree(ptr);
-				return -ENOMEM;
-			}
-			proc->mmap_info[proc->mmap_count++] = info;
-			return (size_t)ptr;
-		}
-		proc->mmap_info[proc->mmap_count++] = info;
-		return (size_t)addr;
 	}
+	if (info.virt_addr + info.length > proc->effective_largest_sz)
+		proc->effective_largest_sz = info.virt_addr + info.length;
+	proc->mmap_info[slot] = info;
+	proc->mmap_count++;
+	return (size_t)info.virt_addr;
 }
 
 size_t
@@ -876,7 +972,8 @@ sys_munmap(void)
 		return -EINVAL;
 	int j = -1;
 	for (int i = 0; i < NMMAP; i++) {
-		if ((proc->mmap_info[i].virt_addr == (uintptr_t)addr) &&
+		if (proc->mmap_info[i].length != 0 &&
+				(proc->mmap_info[i].virt_addr == (uintptr_t)addr) &&
         ((proc->mmap_info[i].length == length) ||
         (proc->mmap_info[i].file && S_ISBLK(proc->mmap_info[i].file->ip->mode)))) {
 			j = i;
@@ -884,27 +981,43 @@ sys_munmap(void)
 	}
 	if (j == -1)
 		return -EINVAL;
-	for (int i = 0; i < PGROUNDUP(proc->mmap_info[j].length); i+= PGSIZE) {
-    unmap_user_page(proc->pgdir, (char *)proc->mmap_info[j].virt_addr);
-	}
-	if (addr != NULL && V2P(addr) < KERNBASE)
-		kfree(addr);
+	if (unmapuvm(proc->pgdir, proc->mmap_info[j].virt_addr,
+							 PGROUNDUP(proc->mmap_info[j].length)) < 0)
+		return -ENOMEM;
+	memset(&proc->mmap_info[j], 0, sizeof(proc->mmap_info[j]));
+	proc->mmap_count--;
+	switchuvm(proc);
+	return 0;
+}
+
+// Report on the root file system's block allocator and the name cache.
+size_t
+sys_fsstat(void)
+{
+	struct fsstat *st;
+
+	if (argptr(0, (void *)&st, sizeof(*st)) < 0)
+		return -EFAULT;
+	balloc_get_stats(ROOTDEV, st);
+	dcache_get_stats(st);
 	return 0;
 }
 
-/* Unimplemented */
+// Wait until every change made to the file so far is on disk.
 size_t
 sys_fsync(void)
 {
-	int fd;
-	struct file *file;
-	if (argfd(0, &fd, &file) < 0)
-		return -EINVAL;
+	struct file *f;
+	uint64_t seq;
+	int r;
 
-	if (fd == 0 || fd == 1 || fd == 2) {
-		if (fd == 0)
-			return -EINVAL;
-		return 0;
-	}
+	if ((r = argfd(0, 0, &f)) < 0)
+		return r;
+	if (f->type != FD_INODE)
+		return -EINVAL;
+	inode_lock(f->ip);
+	seq = f->ip->logseq;
+	inode_unlock(f->ip);
+	log_force(seq);
 	return 0;
 }
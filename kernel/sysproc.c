@@ -2,6 +2,7 @@
 #include <date.h>
 #include <errno.h>
 #include <sys/reboot.h>
+#include <sys/resource.h>
 #include "x86.h"
 #include "proc.h"
 #include "syscall.h"
@@ -11,6 +12,9 @@
 #include "drivers/lapic.h"
 #include "console.h"
 #include "time.h"
+#include "log.h"
+#include "macros.h"
+#include "timeout.h"
 
 size_t
 sys_fork(void)
@@ -81,18 +85,66 @@ sys_sleep(void)
 		return -EINVAL;
 	acquire(&tickslock);
 	ticks0 = ticks;
-	while (ticks - ticks0 < n) {
-		if (myproc()->killed) {
+	release(&tickslock);
+	if (sleep_until(ticks0 + n) < 0)
+		return -ESRCH;
+	return 0;
+}
+
+size_t
+sys_nanosleep(void)
+{
+	struct timespec *req, *rem = NULL;
+	uintptr_t remaddr;
+	time_t n, deadline;
+
+	if (argptr(0, (char **)&req, sizeof(*req)) < 0 ||
+			arguintptr_t(1, &remaddr) < 0)
+		return -EINVAL;
+	if (remaddr != 0 && argptr(1, (char **)&rem, sizeof(*rem)) < 0)
+		return -EFAULT;
+	if (req->tv_nsec < 0 || req->tv_nsec >= 1000000000L)
+		return -EINVAL;
+
+	// Round up to whole ticks, plus one for the tick under way,
+	// which is already partly over.
+	n = req->tv_sec * HZ + (req->tv_nsec * HZ + 999999999) / 1000000000;
+	if (n == 0)
+		return 0;
+	acquire(&tickslock);
+	deadline = ticks + n + 1;
+	release(&tickslock);
+	if (sleep_until(deadline) < 0) {
+		if (rem != NULL) {
+			acquire(&tickslock);
+			n = deadline - min(ticks, deadline);
 			release(&tickslock);
-			return -ESRCH;
+			rem->tv_sec = n / HZ;
+			rem->tv_nsec = (n % HZ) * (1000000000 / HZ);
 		}
-		sleep(&ticks, &tickslock);
+		return -EINTR;
 	}
-	release(&tickslock);
 	return 0;
 }
 
-// return how many clock tick interrupts have occurred
+size_t
+sys_clock_gettime(void)
+{
+	int clock;
+	struct timespec *tp;
+	uint64_t ns;
+
+	if (argint(0, &clock) < 0 || argptr(1, (char **)&tp, sizeof(*tp)) < 0)
+		return -EINVAL;
+	if (clock != CLOCK_MONOTONIC)
+		return -EINVAL;
+	ns = nsec();
+	tp->tv_sec = ns / 1000000000;
+	tp->tv_nsec = ns % 1000000000;
+	return 0;
+}
+
+// return how many ticks, HZ to the second, have passed
 // since start.
 size_t
 sys_uptime(void)
@@ -134,6 +186,8 @@ sys_reboot(void)
 	if (argint(0, &cmd) < 0) {
 		return -EINVAL;
 	}
+	// Commits happen in the background; don't lose the last ones.
+	log_sync();
 
 	switch (cmd) {
 	case RB_POWER_OFF:
@@ -192,3 +246,31 @@ sys_signal(void)
 		return -EINVAL;
 	return (size_t)kernel_attach_signal(signum, handler);
 }
+
+// Returns 20 - nice, so that a successful call is never negative;
+// the C library turns that back into the nice value.
+size_t
+sys_getpriority(void)
+{
+	int which, who, nice, r;
+
+	if (argint(0, &which) < 0 || argint(1, &who) < 0)
+		return -EINVAL;
+	if (which != PRIO_PROCESS)
+		return -EINVAL;
+	if ((r = getnice(who, &nice)) < 0)
+		return r;
+	return 20 - nice;
+}
+
+size_t
+sys_setpriority(void)
+{
+	int which, who, prio;
+
+	if (argint(0, &which) < 0 || argint(1, &who) < 0 || argint(2, &prio) < 0)
+		return -EINVAL;
+	if (which != PRIO_PROCESS)
+		return -EINVAL;
+	return setnice(who, max(NICE_MIN, min(prio, NICE_MAX)));
+}
@@ -0,0 +1,196 @@
+// Timeouts.
+//
+// A hierarchical timing wheel of deadlines, in ticks. Level 0
+// has a slot for each of the next TW_SIZE0 ticks, and each level
+// above has TW_SIZE slots that each cover as many ticks as the
+// whole level below. A timeout goes in the lowest level whose
+// range reaches its deadline. Whenever level 0 wraps around,
+// the next slot of level 1 is emptied back into the wheel
+// ("cascaded"), and so on up. So arming and disarming a timeout
+// take constant time, and a tick only looks at the timeouts that
+// are due then, or that are being cascaded.
+//
+// Each process has one, so that sleep_until() wakes it when its
+// own deadline passes rather than on every tick.
+
+#include <errno.h>
+#include "param.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "timeout.h"
+#include "ioctl.h"
+
+#define TW_BITS0 8
+#define TW_BITS 6
+#define TW_LEVELS 4 // including level 0
+#define TW_SIZE0 (1 << TW_BITS0)
+#define TW_SIZE (1 << TW_BITS)
+// How far ahead the wheel reaches. Later deadlines wait in the
+// top level and are cascaded again until they are in range.
+#define TW_SPAN ((time_t)1 << (TW_BITS0 + (TW_LEVELS - 1) * TW_BITS))
+
+static struct {
+	struct spinlock lock;
+	time_t next; // tick to expire next
+	struct timeout *slot0[TW_SIZE0];
+	struct timeout *slot[TW_LEVELS - 1][TW_SIZE];
+	struct timer_stats stats;
+} tw;
+
+void
+timeout_init(void)
+{
+	initlock(&tw.lock, "timeout");
+}
+
+// The slot that tick t falls in at level l + 1 of the wheel.
+static int
+tw_index(time_t t, int l)
+{
+	return (t >> (TW_BITS0 + l * TW_BITS)) & (TW_SIZE - 1);
+}
+
+// Put t in its slot. Caller holds tw.lock.
+static void
+tw_insert(struct timeout *t)
+{
+	time_t expires = t->expires, delta = expires - tw.next;
+	struct timeout **slot;
+	int l;
+
+	if (expires < tw.next) {
+		slot = &tw.slot0[tw.next & (TW_SIZE0 - 1)];
+	} else if (delta < TW_SIZE0) {
+		slot = &tw.slot0[expires & (TW_SIZE0 - 1)];
+	} else {
+		if (delta >= TW_SPAN)
+			expires = tw.next + TW_SPAN - 1;
+		for (l = 0; l < TW_LEVELS - 2; l++) {
+			if (expires - tw.next < (time_t)1 << (TW_BITS0 + (l + 1) * TW_BITS))
+				break;
+		}
+		slot = &tw.slot[l][tw_index(expires, l)];
+	}
+	t->next = *slot;
+	if (t->next)
+		t->next->pprev = &t->next;
+	t->pprev = slot;
+	*slot = t;
+	tw.stats.pending++;
+}
+
+// Take t out of its slot. Caller holds tw.lock.
+static void
+tw_remove(struct timeout *t)
+{
+	*t->pprev = t->next;
+	if (t->next)
+		t->next->pprev = t->pprev;
+	t->pprev = NULL;
+	tw.stats.pending--;
+}
+
+// Empty level l + 1's slot for tw.next back into the wheel,
+// and return its index.
+static int
+tw_cascade(int l)
+{
+	int i = tw_index(tw.next, l);
+	struct timeout *t;
+
+	while ((t = tw.slot[l][i]) != NULL) {
+		tw_remove(t);
+		tw_insert(t);
+		tw.stats.cascaded++;
+	}
+	return i;
+}
+
+// Expire the timeouts due at tick tw.next.
+static void
+tw_step(void)
+{
+	int i = tw.next & (TW_SIZE0 - 1);
+	struct timeout *t;
+
+	if (i == 0) {
+		for (int l = 0; l < TW_LEVELS - 1; l++) {
+			if (tw_cascade(l) != 0)
+				break;
+		}
+	}
+	tw.next++;
+	while ((t = tw.slot0[i]) != NULL) {
+		tw_remove(t);
+		tw.stats.expired++;
+		wakeup(t);
+	}
+}
+
+// Called on every clock tick, with now the new value of ticks.
+void
+timeout_tick(time_t now)
+{
+	acquire(&tw.lock);
+	while (tw.next <= now)
+		tw_step();
+	release(&tw.lock);
+}
+
+// The next tick for timeout_tick() to do anything at, or 0 if
+// no timeout is armed. It may only be to cascade timeouts that
+// are not due yet, so it is never more than TW_SIZE0 ticks
+// past tw.next, however far off the next one due is.
+time_t
+timeout_next(void)
+{
+	time_t t = 0;
+
+	acquire(&tw.lock);
+	if (tw.stats.pending > 0) {
+		t = tw.next;
+		while ((t & (TW_SIZE0 - 1)) != 0 && tw.slot0[t & (TW_SIZE0 - 1)] == NULL)
+			t++;
+	}
+	release(&tw.lock);
+	return t;
+}
+
+// Sleep until tick deadline has passed. Returns 0, or -EINTR
+// if the process was killed first.
+int
+sleep_until(time_t deadline)
+{
+	struct proc *p = myproc();
+	struct timeout *t = &p->timeout;
+	int r = 0;
+
+	acquire(&tw.lock);
+	tw.stats.sleeps++;
+	while (tw.next <= deadline) {
+		if (p->killed) {
+			r = -EINTR;
+			break;
+		}
+		if (t->pprev == NULL) {
+			t->expires = deadline;
+			tw_insert(t);
+		}
+		sleep(t, &tw.lock);
+		if (tw.next <= deadline && !p->killed)
+			tw.stats.spurious++;
+	}
+	if (t->pprev != NULL)
+		tw_remove(t);
+	release(&tw.lock);
+	return r;
+}
+
+void
+timeout_get_stats(struct timer_stats *st)
+{
+	acquire(&tw.lock);
+	*st = tw.stats;
+	st->ticks = tw.next;
+	release(&tw.lock);
+}
@@ -1,12 +1,15 @@
 // Intel 8253/8254/82C54 Programmable Interval Timer (PIT).
 // Only used on uniprocessors;
-// SMP machines use the local APIC timer.
+// SMP machines use the local APIC timer, and time it
+// against counter 2 here (see lapicinit()).
 
 #include "traps.h"
 #include "x86.h"
 #include "picirq.h"
 
 #define IO_TIMER1 0x040 // 8253 Timer #1
+#define IO_TIMER2 (IO_TIMER1 + 2) // 8253 counter 2, wired to the speaker
+#define IO_PPI 0x061 // counter 2 gate (bit 0) and output (bit 5)
 
 // Frequency of all three count-down timers;
 // (TIMER_FREQ/freq) is the appropriate count
@@ -17,6 +20,8 @@
 
 #define TIMER_MODE (IO_TIMER1 + 3) // timer mode port
 #define TIMER_SEL0 0x00 // select counter 0
+#define TIMER_SEL2 0x80 // select counter 2
+#define TIMER_INTTC 0x00 // mode 0, output high on terminal count
 #define TIMER_RATEGEN 0x04 // mode 2, rate generator
 #define TIMER_16BIT 0x30 // r/w counter 16 bits, LSB first
 
@@ -29,3 +34,21 @@ timerinit(void)
 	outb(IO_TIMER1, TIMER_DIV(100) / 256);
 	picenable(IRQ_TIMER);
 }
+
+// Spin for ms milliseconds, at most 54, as counted by the
+// speaker's counter, which interrupts nobody.
+void
+pit_wait(int ms)
+{
+	uint32_t count = TIMER_FREQ * ms / 1000;
+	uint8_t ppi = inb(IO_PPI) & ~0x03; // gate and speaker off
+
+	outb(IO_PPI, ppi);
+	outb(TIMER_MODE, TIMER_SEL2 | TIMER_INTTC | TIMER_16BIT);
+	outb(IO_TIMER2, count % 256);
+	outb(IO_TIMER2, count / 256);
+	outb(IO_PPI, ppi | 0x01);
+	while ((inb(IO_PPI) & 0x20) == 0)
+		;
+	outb(IO_PPI, ppi);
+}
@@ -16,6 +16,8 @@
 #include "console.h"
 #include <stdint.h>
 #include "time.h"
+#include "vm.h"
+#include "timeout.h"
 enum {
 	PAGE_FAULT_PRESENT = 1 << 0,
 	PAGE_FAULT_WRITE = 1 << 1,
@@ -75,15 +77,24 @@ trap(struct trapframe *tf)
 	}
 
 	switch (tf->trapno) {
-	case T_IRQ0 + IRQ_TIMER:
-		if (my_cpu_id() == 0) {
+	case T_IRQ0 + IRQ_TIMER: {
+		// ticks follows the TSC, and any CPU whose timer is
+		// running moves it on, since idle ones stop theirs.
+		time_t now = nsec() / TICK_NSEC;
+		if (now > __atomic_load_n(&ticks, __ATOMIC_RELAXED)) {
 			acquire(&tickslock);
-			ticks++;
-			wakeup(&ticks);
+			if (now > ticks) {
+				ticks = now;
+				timeout_tick(now);
+			}
 			release(&tickslock);
 		}
 		lapiceoi();
 		break;
+	}
+	case T_IRQ0 + IRQ_WAKE:
+		lapiceoi();
+		break;
 	case T_IRQ0 + IRQ_IDE:
 		ideintr();
 		lapiceoi();
@@ -129,8 +140,9 @@ trap(struct trapframe *tf)
 
 		}
 		break;
-	// TODO handle pagefaults in a way that allows copy-on-write
 	case T_PGFLT:
+		if (pagefault(myproc(), rcr2(), tf->err & PAGE_FAULT_WRITE) == 0)
+			break;
 		uart_cprintf("Page fault at %#lx, ip=%#lx\n", rcr2(), tf->eip);
 		decipher_page_fault_error_code(tf->err);
 		if ((tf->cs & DPL_USER) == 0)
@@ -169,11 +181,12 @@ trap(struct trapframe *tf)
 	if (myproc() && myproc()->killed && (tf->cs & 3) == DPL_USER)
 		exit(0);
 
-	// Force process to give up CPU on clock tick.
+	// Give up the CPU if this process has had its share
+	// (checked on clock ticks), or one that just woke up
+	// here is owed it more.
 	// If interrupts were on while locks held, would need to check nlock.
-	if (myproc() && myproc()->state == RUNNING &&
-			tf->trapno == T_IRQ0 + IRQ_TIMER)
-		yield();
+	if (myproc() && myproc()->state == RUNNING)
+		preempt(tf->trapno == T_IRQ0 + IRQ_TIMER);
 
 	// Check if the process has been killed since we yielded
 	if (myproc() && myproc()->killed && (tf->cs & 3) == DPL_USER)
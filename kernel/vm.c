@@ -10,14 +10,19 @@
 #include "vm.h"
 #include "fs.h"
 #include "spinlock.h"
+#include "macros.h"
 #include <string.h>
 
+#define HUGEPG_ORDER (PDXSHIFT - PGSHIFT) // of a large page's block
+
 extern char data[]; // defined by kernel.ld
+extern uint64_t available_memory;
 uintptr_t *kpgdir; // for use in scheduler()
 
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page table pages.
+// create any required page table pages. If va is in a
+// large page, returns its page directory entry instead.
 static pte_t *
 walkpgdir(uintptr_t *pgdir, const void *va, int alloc)
 {
@@ -25,16 +30,17 @@ walkpgdir(uintptr_t *pgdir, const void *va, int alloc)
 	pte_t *pgtab;
 
 	pde = &pgdir[PDX(va)];
-	if (*pde & PTE_P) {
+	if ((*pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS)) {
+		return pde;
+	} else if (*pde & PTE_P) {
 		pgtab = (pte_t *)p2v(PTE_ADDR(*pde));
 	} else {
 
 		// Not present? We need to allocate. But if we aren't allocating,
 		// this makes no sense to do.
-		if (!alloc || (pgtab = (pte_t *)kpage_alloc()) == 0)
-			return 0;
 		// Make sure all those PTE_P bits are zero.
-		memset(pgtab, 0, PGSIZE);
+		if (!alloc || (pgtab = (pte_t *)kpage_alloc_zeroed()) == 0)
+			return 0;
 		// The permissions here are overly generous, but they can
 		// be further restricted by the permissions in the page table
 		// entries, if necessary.
@@ -43,6 +49,49 @@ walkpgdir(uintptr_t *pgdir, const void *va, int alloc)
 	return &pgtab[PTX(va)];
 }
 
+// The page directory entry mapping the large page
+// that holds va, or 0 if va is not in one.
+static uintptr_t *
+hugepde(uintptr_t *pgdir, uintptr_t va)
+{
+	uintptr_t *pde = &pgdir[PDX(va)];
+
+	if ((*pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS))
+		return pde;
+	return 0;
+}
+
+// The physical address of the page that pte maps at va,
+// where pte may be a large page's directory entry.
+static uintptr_t
+pte_page(pte_t pte, const void *va)
+{
+	if (pte & PTE_PS)
+		return PTE_ADDR(pte) + (PGROUNDDOWN((uintptr_t)va) & (HUGEPGSIZE - 1));
+	return PTE_ADDR(pte);
+}
+
+// Replace the large page that *pde maps with a page table
+// mapping the same memory with the same permissions, one
+// page at a time. The caller must flush the TLB.
+// Returns -1 if there is no memory for the page table.
+static int
+demote(uintptr_t *pde)
+{
+	pte_t *pgtab;
+	uintptr_t pa = PTE_ADDR(*pde), flags = PTE_FLAGS(*pde) & ~PTE_PS;
+
+	if ((pgtab = (pte_t *)kpage_alloc()) == 0)
+		return -1;
+	for (int i = 0; i < NPTENTRIES; i++)
+		pgtab[i] = (pa + i * PGSIZE) | flags;
+	// From now on, its pages are freed one at a time.
+	if (pa < available_memory)
+		kpages_split(p2v(pa));
+	*pde = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+	return 0;
+}
+
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
 // be page-aligned.
@@ -68,6 +117,33 @@ mappages(uintptr_t *pgdir, void *va, uintptr_t size, uintptr_t pa, int perm)
 	return 0;
 }
 
+// Like mappages(), for device memory: where va and pa are both
+// aligned to a large page, map large pages instead.
+int
+mapdevice(uintptr_t *pgdir, uintptr_t va, uintptr_t size, uintptr_t pa,
+					int perm)
+{
+	uintptr_t *pde, end = va + size;
+
+	while (va < end) {
+		if (va % HUGEPGSIZE == 0 && pa % HUGEPGSIZE == 0 &&
+				end - va >= HUGEPGSIZE) {
+			pde = &pgdir[PDX(va)];
+			if (*pde & PTE_P)
+				panic("remap");
+			*pde = pa | perm | PTE_P | PTE_PS;
+			va += HUGEPGSIZE;
+			pa += HUGEPGSIZE;
+			continue;
+		}
+		if (mappages(pgdir, (void *)va, PGSIZE, pa, perm) < 0)
+			return -1;
+		va += PGSIZE;
+		pa += PGSIZE;
+	}
+	return 0;
+}
+
 // Load the initcode into address 0 of pgdir.
 // sz must be less than a page.
 void
@@ -77,8 +153,7 @@ inituvm(uintptr_t *pgdir, char *init, uint32_t sz)
 
 	if (sz >= PGSIZE)
 		panic("inituvm: more than a page");
-	mem = kpage_alloc();
-	memset(mem, 0, PGSIZE);
+	mem = kpage_alloc_zeroed();
 	mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W | PTE_U);
 	memmove(mem, init, sz);
 }
@@ -97,7 +172,7 @@ loaduvm(uintptr_t *pgdir, char *addr, struct inode *ip, uint32_t offset,
 	for (i = 0; i < sz; i += PGSIZE) {
 		if ((pte = walkpgdir(pgdir, addr + i, 0)) == 0)
 			panic("loaduvm: address should exist");
-		pa = PTE_ADDR(*pte);
+		pa = pte_page(*pte, addr + i);
 		if (sz - i < PGSIZE)
 			n = sz - i;
 		else
@@ -123,13 +198,12 @@ allocuvm(uintptr_t *pgdir, uintptr_t oldsz, uintptr_t newsz)
 
 	a = PGROUNDUP(oldsz);
 	for (; a < newsz; a += PGSIZE) {
-		mem = kpage_alloc();
+		mem = kpage_alloc_zeroed();
 		if (mem == 0) {
 			cprintf("allocuvm out of memory\n");
 			deallocuvm(pgdir, newsz, oldsz);
 			return 0;
 		}
-		memset(mem, 0, PGSIZE);
 		if (mappages(pgdir, (char *)a, PGSIZE, V2P(mem), PTE_W | PTE_U) < 0) {
 			cprintf("allocuvm out of memory (2)\n");
 			deallocuvm(pgdir, newsz, oldsz);
@@ -156,21 +230,31 @@ deallocuvm(uintptr_t *pgdir, uintptr_t oldsz, uintptr_t newsz)
 	a = PGROUNDUP(newsz);
 	for (; a < oldsz; a += PGSIZE) {
 		pte = walkpgdir(pgdir, (char *)a, 0);
+		// Free a large page whole, or split it if only
+		// part of it goes away. Should there be no memory
+		// for that, the part stays mapped until it does go.
+		if (pte && (*pte & PTE_PS) &&
+				(a % HUGEPGSIZE != 0 || oldsz - a < HUGEPGSIZE)) {
+			if (demote(pte) < 0) {
+				a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+				continue;
+			}
+			pte = walkpgdir(pgdir, (char *)a, 0);
+		}
 		if (!pte) {
-			//a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
-			a += (NPTENTRIES - 1) * PGSIZE;
+			a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
 		} else if ((*pte & PTE_P) != 0) {
 			pa = PTE_ADDR(*pte);
 			if (pa == 0)
 				panic("kpage_free");
-			// Temporary hack.
-			// The only set of memory above the physical address of KERNBASE
-			// is a device's mmio. Since those aren't allocated, just ignore
-			// them.
-			if ((uintptr_t)P2V(pa) > KERNBASE) {
-				char *v = p2v(pa);
-				kpage_free(v);
-			}
+			// Device memory, such as a frame buffer, is mapped
+			// but was never allocated.
+			if (pa < available_memory && (*pte & PTE_PS))
+				kpages_put(p2v(pa), HUGEPG_ORDER);
+			else if (pa < available_memory)
+				kpage_free(p2v(pa));
+			if (*pte & PTE_PS)
+				a += HUGEPGSIZE - PGSIZE;
 			*pte = 0;
 		}
 	}
@@ -186,7 +270,7 @@ freevm(uintptr_t *pgdir)
 
 	if (pgdir == 0)
 		panic("freevm: no pgdir");
-	deallocuvm(pgdir, /*KERNBASE*/ 0x3fa00000, 0);
+	deallocuvm(pgdir, USERTOP, 0);
 	for (i = 0; i < NPDENTRIES - 2; i++) {
 		if (pgdir[i] & PTE_P) {
 			char *v = P2V(PTE_ADDR(pgdir[i]));
@@ -204,55 +288,282 @@ clearpteu(uintptr_t *pgdir, char *uva)
 	pte_t *pte;
 
 	pte = walkpgdir(pgdir, uva, 0);
+	if (pte != 0 && (*pte & PTE_PS)) {
+		if (demote(pte) < 0)
+			panic("clearpteu: demote");
+		pte = walkpgdir(pgdir, uva, 0);
+	}
 	if (pte == 0)
 		panic("clearpteu");
 	*pte &= ~PTE_U;
 }
 
-void
-unmap_user_page(uintptr_t *pgdir, char *user_va)
+// Remove the mappings of [va, va + size) from pgdir, and drop
+// its references to the memory behind them; device memory was
+// never allocated, and is left alone. The caller must flush the
+// TLB. Returns -1, having changed nothing, if a large page that
+// is only partly in the range can't be split for want of memory.
+int
+unmapuvm(uintptr_t *pgdir, uintptr_t va, uintptr_t size)
 {
+	uintptr_t a, pa, end = va + size, edge[2] = { va, end - 1 };
+	uintptr_t *pde;
 	pte_t *pte;
 
-	pte = walkpgdir(pgdir, user_va, 0);
-	if (pte == 0) {
-		panic("unmap_user_page: no page found");
+	if (size == 0)
+		return 0;
+	// Only the large pages at either end can be partly in it.
+	for (int i = 0; i < 2; i++) {
+		a = HUGEPGROUNDDOWN(edge[i]);
+		if ((pde = hugepde(pgdir, a)) != 0 &&
+				(a < PGROUNDDOWN(va) || a + HUGEPGSIZE > end) && demote(pde) < 0)
+			return -1;
 	}
-	// Clear all bits in the PTE.
-	*pte = 0;
+	for (a = PGROUNDDOWN(va); a < end; a += PGSIZE) {
+		pte = walkpgdir(pgdir, (void *)a, 0);
+		if (pte == 0) {
+			a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+			continue;
+		}
+		if ((*pte & PTE_P) == 0)
+			continue;
+		pa = PTE_ADDR(*pte);
+		if (pa < available_memory && (*pte & PTE_PS))
+			kpages_put(p2v(pa), HUGEPG_ORDER);
+		else if (pa < available_memory)
+			kpage_free(p2v(pa));
+		if (*pte & PTE_PS)
+			a += HUGEPGSIZE - PGSIZE;
+		*pte = 0;
+	}
+	return 0;
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. Writable pages are not copied: both
+// page tables map them read-only with PTE_COW set and the
+// first write from either side takes a private copy (see
+// uvm_cow()). Large pages are shared whole.
+// The caller must flush the parent's TLB.
 uintptr_t *
 copyuvm(uintptr_t *pgdir, uint32_t sz)
 {
-	uintptr_t *d;
+	uintptr_t *d, *pde;
 	pte_t *pte;
 	uintptr_t pa, i, flags;
-	char *mem;
 
 	if ((d = setupkvm()) == 0)
 		return 0;
 	for (i = 0; i < sz; i += PGSIZE) {
-		if ((pte = walkpgdir(pgdir, (void *)i, 0)) == 0)
-			panic("copyuvm: pte should exist");
+		if ((pde = hugepde(pgdir, i)) != 0) {
+			if (*pde & PTE_W)
+				*pde = (*pde & ~PTE_W) | PTE_COW;
+			d[PDX(i)] = *pde;
+			if (PTE_ADDR(*pde) < available_memory)
+				kpages_ref(p2v(PTE_ADDR(*pde)), HUGEPG_ORDER);
+			i += HUGEPGSIZE - PGSIZE;
+			continue;
+		}
+		// Pages that were never touched are filled in
+		// by the child itself, if it ever needs them.
+		if ((pte = walkpgdir(pgdir, (void *)i, 0)) == 0) {
+			i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+			continue;
+		}
 		if (!(*pte & PTE_P))
-			panic("copyuvm: page not present");
+			continue;
+		if (*pte & PTE_W)
+			*pte = (*pte & ~PTE_W) | PTE_COW;
 		pa = PTE_ADDR(*pte);
 		flags = PTE_FLAGS(*pte);
+		if (mappages(d, (void *)i, PGSIZE, pa, flags) < 0)
+			goto bad;
+		kpage_ref(p2v(pa));
+	}
+	return d;
+
+bad:
+	freevm(d);
+	return 0;
+}
+
+// Give pgdir a private, writable copy of the copy-on-write
+// page at va. If no other page table maps the page anymore,
+// it is simply made writable again. A shared large page is
+// split, and only the page at va copied.
+// Returns 0 on success, -1 if va is not copy-on-write or
+// there is no memory for the copy.
+int
+uvm_cow(uintptr_t *pgdir, uintptr_t va)
+{
+	pte_t *pte;
+	char *mem, *old;
+
+	if (va >= USERTOP)
+		return -1;
+	va = PGROUNDDOWN(va);
+	if ((pte = walkpgdir(pgdir, (void *)va, 0)) == 0)
+		return -1;
+	if ((*pte & (PTE_P | PTE_U | PTE_COW)) != (PTE_P | PTE_U | PTE_COW))
+		return -1;
+	if (*pte & PTE_PS) {
+		old = p2v(PTE_ADDR(*pte));
+		if (kpage_order(old) == HUGEPG_ORDER && kpage_refcount(old) == 1) {
+			*pte = (*pte | PTE_W) & ~PTE_COW;
+			invlpg((void *)va);
+			return 0;
+		}
+		if (demote(pte) < 0)
+			return -1;
+		invlpg((void *)va);
+		pte = walkpgdir(pgdir, (void *)va, 0);
+	}
+	old = p2v(PTE_ADDR(*pte));
+	if (kpage_refcount(old) == 1) {
+		*pte = (*pte | PTE_W) & ~PTE_COW;
+	} else {
 		if ((mem = kpage_alloc()) == 0)
+			return -1;
+		memmove(mem, old, PGSIZE);
+		*pte = V2P(mem) | ((PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW);
+		kpage_free(old);
+	}
+	invlpg((void *)va);
+	return 0;
+}
+
+// Take a reference to every file backing the areas in src
+// and copy them to dst.
+void
+vmareas_dup(struct vmarea *dst, struct vmarea *src)
+{
+	for (int i = 0; i < NVMAREA; i++) {
+		dst[i] = src[i];
+		if (dst[i].ip != NULL)
+			inode_dup(dst[i].ip);
+	}
+}
+
+// Drop the areas and the files backing them.
+// Must be called inside a transaction.
+void
+vmareas_put(struct vmarea *areas)
+{
+	for (int i = 0; i < NVMAREA; i++) {
+		if (areas[i].ip != NULL)
+			inode_put(areas[i].ip);
+		memset(&areas[i], 0, sizeof(areas[i]));
+	}
+}
+
+// Back the large page around va with a zeroed block of memory,
+// if all of it is heap that was never touched and such a block
+// is free. Returns 0 on success.
+static int
+uvm_fill_huge(struct proc *p, uintptr_t va)
+{
+	uintptr_t base = HUGEPGROUNDDOWN(va);
+	uintptr_t *pde = &p->pgdir[PDX(base)];
+	struct vmarea *a;
+	char *mem;
+
+	if (base + HUGEPGSIZE > p->sz || (*pde & PTE_P))
+		return -1;
+	for (a = p->vmareas; a < &p->vmareas[NVMAREA]; a++)
+		if (a->start < base + HUGEPGSIZE && a->end > base)
+			return -1;
+	if ((mem = kpages_alloc(HUGEPG_ORDER)) == 0)
+		return -1;
+	memset(mem, 0, HUGEPGSIZE);
+	*pde = V2P(mem) | PTE_P | PTE_W | PTE_U | PTE_PS;
+	return 0;
+}
+
+// Back the missing page at va: from the area of p that covers
+// it, or with zeroes for the heap and anything else below p->sz.
+static int
+uvm_fill(struct proc *p, uintptr_t va)
+{
+	struct vmarea *a;
+	char *mem;
+	uint64_t off, n;
+	int held, perm;
+
+	for (a = p->vmareas; a < &p->vmareas[NVMAREA]; a++)
+		if (va >= a->start && va < a->end)
+			break;
+	if (a == &p->vmareas[NVMAREA] && uvm_fill_huge(p, va) == 0)
+		return 0;
+	if ((mem = kpage_alloc_zeroed()) == 0)
+		return -1;
+	if (a == &p->vmareas[NVMAREA]) {
+		perm = PTE_W | PTE_U;
+		goto map;
+	}
+	perm = a->perm;
+	off = va - a->start;
+	if (a->ip != NULL && off < a->filesz) {
+		// Reading the file may sleep, which the faulting
+		// code can only do if it holds no spinlocks.
+		pushcli();
+		held = mycpu()->ncli > 1;
+		popcli();
+		if (held)
 			goto bad;
-		memmove(mem, (char *)p2v(pa), PGSIZE);
-		if (mappages(d, (void *)i, PGSIZE, V2P(mem), flags) < 0) {
-			kpage_free(mem);
+		n = min(PGSIZE, a->filesz - off);
+		inode_lock(a->ip);
+		if (inode_read(a->ip, mem, a->off + off, n) != n) {
+			inode_unlock(a->ip);
 			goto bad;
 		}
+		inode_unlock(a->ip);
 	}
-	return d;
+map:
+	if (mappages(p->pgdir, (void *)va, PGSIZE, V2P(mem), perm) < 0)
+		goto bad;
+	return 0;
 
 bad:
-	freevm(d);
+	kpage_free(mem);
+	return -1;
+}
+
+// Handle a page fault at va taken by p, either in user mode
+// or while the kernel accessed p's memory on its behalf.
+// Returns 0 if the faulting access can be restarted.
+int
+pagefault(struct proc *p, uintptr_t va, int write)
+{
+	pte_t *pte;
+
+	if (p == NULL || p->pgdir == NULL || va >= p->sz)
+		return -1;
+	va = PGROUNDDOWN(va);
+	pte = walkpgdir(p->pgdir, (void *)va, 0);
+	if (pte != NULL && (*pte & PTE_P)) {
+		if (write)
+			return uvm_cow(p->pgdir, va);
+		return -1;
+	}
+	return uvm_fill(p, va);
+}
+
+// Fault in the pages of p covering [va, va + len) ahead of time,
+// so that the kernel can touch them while holding spinlocks.
+// If write is set, also split pages shared copy-on-write, so
+// the kernel's writes cannot fault for want of memory.
+int
+uvm_prefault(struct proc *p, uintptr_t va, size_t len, int write)
+{
+	pte_t *pte;
+
+	for (uintptr_t a = PGROUNDDOWN(va); a < va + len && a < p->sz; a += PGSIZE) {
+		pte = walkpgdir(p->pgdir, (void *)a, 0);
+		if (pte != NULL && (*pte & PTE_P) && !(write && (*pte & PTE_COW)))
+			continue;
+		if (pagefault(p, a, write) < 0)
+			return -1;
+	}
 	return 0;
 }
 
@@ -269,7 +580,7 @@ uva2ka(uintptr_t *pgdir, char *uva)
 		return 0;
 	if ((*pte & PTE_U) == 0)
 		return 0;
-	return (char *)p2v(PTE_ADDR(*pte));
+	return (char *)p2v(pte_page(*pte, uva));
 }
 
 // Copy len bytes from p to user address va in page table pgdir.
@@ -280,10 +591,20 @@ copyout(uintptr_t *pgdir, uintptr_t va, void *p, size_t len)
 {
 	char *buf, *pa0;
 	uintptr_t n, va0;
+	pte_t *pte;
 
 	buf = (char *)p;
 	while (len > 0) {
 		va0 = (uint32_t)PGROUNDDOWN(va);
+		// We write through the kernel's mapping of the page,
+		// so a shared page has to be split here.
+		pte = walkpgdir(pgdir, (char *)va0, 0);
+		if (pte != NULL && (*pte & PTE_COW) && uvm_cow(pgdir, va0) < 0)
+			return -1;
+		// Likewise, a page nobody touched yet has to be backed.
+		if ((pte == NULL || !(*pte & PTE_P)) && myproc() != NULL &&
+				pgdir == myproc()->pgdir && pagefault(myproc(), va0, 1) < 0)
+			return -1;
 		pa0 = uva2ka(pgdir, (char *)va0);
 		if (pa0 == 0)
 			return -1;
@@ -0,0 +1,63 @@
+// Time name lookups in a big directory. Makes thousands of
+// hard links to one file (the file system has few inodes),
+// opens each name, then removes them, printing the ticks
+// each pass took. Usage: dirbench [nnames]
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <ext.h>
+#include <sys/stat.h>
+
+int
+main(int argc, char *argv[])
+{
+	int fd, i, n = 2000, t0;
+	char name[32];
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+	if (mkdir("dirbench.d") < 0 || chdir("dirbench.d") < 0) {
+		fprintf(stderr, "dirbench: cannot make dirbench.d\n");
+		exit(1);
+	}
+	if ((fd = open("target", O_CREATE | O_RDWR)) < 0) {
+		fprintf(stderr, "dirbench: cannot create target\n");
+		exit(1);
+	}
+	close(fd);
+
+	t0 = uptime();
+	for (i = 0; i < n; i++) {
+		sprintf(name, "name%d", i);
+		if (link("target", name) < 0) {
+			fprintf(stderr, "dirbench: link %s failed\n", name);
+			exit(1);
+		}
+	}
+	printf("link:   %d names in %d ticks\n", n, uptime() - t0);
+
+	t0 = uptime();
+	for (i = n - 1; i >= 0; i--) {
+		sprintf(name, "name%d", i);
+		if ((fd = open(name, O_RDONLY)) < 0) {
+			fprintf(stderr, "dirbench: open %s failed\n", name);
+			exit(1);
+		}
+		close(fd);
+	}
+	printf("lookup: %d names in %d ticks\n", n, uptime() - t0);
+
+	t0 = uptime();
+	for (i = 0; i < n; i++) {
+		sprintf(name, "name%d", i);
+		unlink(name);
+	}
+	printf("unlink: %d names in %d ticks\n", n, uptime() - t0);
+
+	unlink("target");
+	chdir("..");
+	unlink("dirbench.d");
+	return 0;
+}
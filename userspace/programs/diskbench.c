@@ -0,0 +1,74 @@
+// Compare IDE throughput with PIO and with bus master DMA.
+// Writes a file, reads it back, and reports the ticks each took.
+// Switching DMA takes root.
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <ext.h>
+#include <sys/ioctl.h>
+
+#define FILESIZE (2 * 1024 * 1024)
+#define CHUNK 8192
+
+static char buf[CHUNK];
+
+static void
+run(const char *mode)
+{
+	int fd, n, t0, twrite, tread;
+
+	unlink("diskbench.tmp");
+	fd = open("diskbench.tmp", O_CREATE | O_RDWR);
+	if (fd < 0) {
+		fprintf(stderr, "diskbench: cannot create diskbench.tmp\n");
+		exit(1);
+	}
+	t0 = uptime();
+	for (n = 0; n < FILESIZE; n += CHUNK) {
+		if (write(fd, buf, CHUNK) != CHUNK) {
+			fprintf(stderr, "diskbench: write failed\n");
+			exit(1);
+		}
+	}
+	twrite = uptime() - t0;
+	close(fd);
+
+	// The file is far larger than the buffer cache,
+	// so this goes to the disk too.
+	fd = open("diskbench.tmp", O_RDONLY);
+	t0 = uptime();
+	while ((n = read(fd, buf, CHUNK)) > 0)
+		;
+	tread = uptime() - t0;
+	close(fd);
+	unlink("diskbench.tmp");
+
+	printf("%s: wrote %d KiB in %d ticks, read it in %d ticks\n", mode,
+				 FILESIZE / 1024, twrite, tread);
+}
+
+int
+main(void)
+{
+	int dma = 0;
+
+	memset(buf, 'd', sizeof(buf));
+	if (ioctl(0, IDEIOCGDMA, &dma) < 0) {
+		perror("ioctl");
+		exit(1);
+	}
+	if (ioctl(0, IDEIOCSDMA, 0) < 0) {
+		perror("ioctl");
+		exit(1);
+	}
+	run("pio");
+	if (ioctl(0, IDEIOCSDMA, 1) < 0)
+		printf("dma: no bus master IDE controller\n");
+	else
+		run("dma");
+	ioctl(0, IDEIOCSDMA, dma);
+	return 0;
+}
@@ -0,0 +1,81 @@
+// Several processes each fork and reap short-lived children as
+// fast as they can, which allocates and frees page tables, kernel
+// stacks and copy-on-write pages on every CPU. Reports how often
+// each CPU found a page allocator lock held by another CPU.
+// Usage: forkbench [nproc [nforks]]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <ext.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+// Outside main so fork() cannot clobber them.
+static int nproc = 4, nforks = 200, n;
+static struct mem_stats before, after;
+
+static void
+run(void)
+{
+	for (n = 0; n < nforks; n++) {
+		int pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "forkbench: fork failed\n");
+			exit(1);
+		}
+		if (pid == 0)
+			exit(0);
+		wait(NULL);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	int p, t0;
+
+	if (argc > 1)
+		nproc = atoi(argv[1]);
+	if (argc > 2)
+		nforks = atoi(argv[2]);
+	if (nproc < 1 || nforks < 1) {
+		fprintf(stderr, "usage: forkbench [nproc [nforks]]\n");
+		exit(1);
+	}
+	if (ioctl(0, MEMIOCGSTATS, &before) < 0) {
+		perror("ioctl");
+		exit(1);
+	}
+
+	t0 = uptime();
+	for (p = 0; p < nproc; p++) {
+		int pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "forkbench: fork failed\n");
+			exit(1);
+		}
+		if (pid == 0) {
+			run();
+			exit(0);
+		}
+	}
+	for (p = 0; p < nproc; p++)
+		wait(NULL);
+	printf("%d processes forked %d children each in %d ticks\n", nproc, nforks,
+				 uptime() - t0);
+
+	if (ioctl(0, MEMIOCGSTATS, &after) < 0) {
+		perror("ioctl");
+		exit(1);
+	}
+	for (uint32_t c = 0; c < after.ncpu; c++) {
+		struct mem_cpu_stats *b = &before.cpu[c], *a = &after.cpu[c];
+		printf("cpu %u: %lu allocs, %lu refills, %lu drains, %lu stolen, "
+					 "%lu of %lu locks contended\n",
+					 c, a->allocs - b->allocs, a->refills - b->refills,
+					 a->drains - b->drains, a->steals - b->steals,
+					 a->contended - b->contended, a->acquires - b->acquires);
+	}
+	return 0;
+}
@@ -0,0 +1,29 @@
+// Report how the root file system's blocks are allocated:
+// how fragmented the free space is, how often new blocks
+// landed right after the file's previous one, and how long
+// allocation takes, and how well the name cache does.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/fsstat.h>
+
+int
+main(void)
+{
+	struct fsstat st;
+
+	if (fsstat(&st) < 0) {
+		perror("fsstat");
+		exit(1);
+	}
+	printf("blocks:     %u, %u free\n", st.nblocks, st.nfree);
+	printf("free space: %u extents, longest %u blocks\n", st.nextents,
+				 st.maxextent);
+	printf("allocated:  %lu blocks, %lu contiguous, %lu freed\n", st.allocs,
+				 st.contiguous, st.frees);
+	printf("latency:    %lu cycles on average, %lu at most\n",
+				 st.allocs ? st.latency / st.allocs : 0, st.maxlatency);
+	printf("name cache: %lu hits, %lu negative hits, %lu misses\n", st.dc_hits,
+				 st.dc_neghits, st.dc_misses);
+	return 0;
+}
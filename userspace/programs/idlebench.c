@@ -0,0 +1,87 @@
+// Leaves nsleepers processes asleep with deadlines well in the
+// future while the parent sleeps for nticks ticks, so the system
+// is idle but for the clock. Reports how many processes were
+// woken meanwhile, how many of those wakeups were spurious (a
+// sleeper woken before its deadline, only to sleep again), and
+// how often idle CPUs halted with their timers stopped.
+// Usage: idlebench [nsleepers [nticks]]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <ext.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#define MAXSLEEPERS 60
+
+// Outside main so fork() cannot clobber them.
+static int nsleepers = 32, nticks = 1000, n;
+static int sleepers[MAXSLEEPERS];
+static struct sched_stats sbefore, safter;
+static struct timer_stats tbefore, tafter;
+static uint64_t woken, halts, kicks;
+
+int
+main(int argc, char *argv[])
+{
+	int t0, ticks;
+
+	if (argc > 1)
+		nsleepers = atoi(argv[1]);
+	if (argc > 2)
+		nticks = atoi(argv[2]);
+	if (nsleepers < 0 || nsleepers > MAXSLEEPERS || nticks < 1) {
+		fprintf(stderr, "usage: idlebench [nsleepers [nticks]]\n");
+		exit(1);
+	}
+
+	// Stagger the deadlines, all past the end of the run.
+	for (n = 0; n < nsleepers; n++) {
+		sleepers[n] = fork();
+		if (sleepers[n] < 0) {
+			fprintf(stderr, "idlebench: fork failed\n");
+			exit(1);
+		}
+		if (sleepers[n] == 0) {
+			sleep(2 * nticks + n);
+			exit(0);
+		}
+	}
+	sleep(1);
+
+	if (ioctl(0, SCHEDIOCGSTATS, &sbefore) < 0 ||
+			ioctl(0, TIMERIOCGSTATS, &tbefore) < 0) {
+		perror("ioctl");
+		exit(1);
+	}
+	t0 = uptime();
+	sleep(nticks);
+	ticks = uptime() - t0;
+	if (ioctl(0, SCHEDIOCGSTATS, &safter) < 0 ||
+			ioctl(0, TIMERIOCGSTATS, &tafter) < 0) {
+		perror("ioctl");
+		exit(1);
+	}
+
+	for (n = 0; n < nsleepers; n++)
+		kill(sleepers[n], SIGKILL);
+	for (n = 0; n < nsleepers; n++)
+		wait(NULL);
+
+	for (uint32_t c = 0; c < safter.ncpu; c++) {
+		woken += safter.cpu[c].woken - sbefore.cpu[c].woken;
+		halts += safter.cpu[c].halts - sbefore.cpu[c].halts;
+		kicks += safter.cpu[c].kicks - sbefore.cpu[c].kicks;
+	}
+	printf("%d sleepers idle for %d ticks\n", nsleepers, ticks);
+	printf("%lu processes woken, %lu of them spuriously\n", woken,
+				 tafter.spurious - tbefore.spurious);
+	printf("%lu timeouts expired, %lu cascaded, %lu pending\n",
+				 tafter.expired - tbefore.expired,
+				 tafter.cascaded - tbefore.cascaded, tafter.pending);
+	printf("%lu halts with the timer stopped on %u cpus, %lu kicks\n", halts,
+				 safter.ncpu, kicks);
+	return 0;
+}
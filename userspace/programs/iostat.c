@@ -0,0 +1,27 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+
+int
+main(void)
+{
+	struct ide_stats st;
+	struct bio_stats bst;
+
+	if (ioctl(0, IDEIOCGSTATS, &st) < 0 || ioctl(0, BIOIOCGSTATS, &bst) < 0) {
+		perror("ioctl");
+		exit(1);
+	}
+	printf("blocks:    %lu in %lu commands (%lu merged)\n", st.requests,
+				 st.commands, st.merged);
+	printf("queue:     %u now, %u at most\n", st.depth, st.maxdepth);
+	printf("latency:   %lu cycles on average, %lu at most\n",
+				 st.requests ? st.latency / st.requests : 0, st.maxlatency);
+	printf("cache:     %u buffers, %lu hits, %lu misses, %lu evictions\n",
+				 bst.nbuf, bst.hits, bst.misses, bst.evictions);
+	printf("locks:     %lu bucket locks taken, %lu contended\n", bst.acquires,
+				 bst.contended);
+	printf("readahead: %lu blocks, %lu used, %lu evicted unused\n",
+				 bst.ra_issued, bst.ra_hits, bst.ra_wasted);
+	return 0;
+}
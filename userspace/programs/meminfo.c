@@ -0,0 +1,29 @@
+// Print how much physical memory is free, and in what sizes
+// of contiguous blocks.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+
+int
+main(void)
+{
+	struct mem_stats st;
+	uint64_t nfree;
+
+	if (ioctl(0, MEMIOCGSTATS, &st) < 0) {
+		perror("ioctl");
+		exit(1);
+	}
+	nfree = st.cached + st.zeroed;
+	for (int i = 0; i < 11; i++)
+		nfree += st.nfree[i] << i;
+	printf("memory: %lu KiB, %lu KiB free, %lu KiB on CPU lists\n",
+				 st.pages * 4, nfree * 4, st.cached * 4);
+	printf("zeroed: %lu pages ready, %lu used, %lu zeroed on demand, "
+				 "%lu zeroed while idle\n",
+				 st.zeroed, st.zero_hits, st.zero_misses, st.zero_filled);
+	for (int i = 0; i < 11; i++)
+		printf("order %2d: %6lu blocks of %4d KiB\n", i, st.nfree[i], 4 << i);
+	return 0;
+}
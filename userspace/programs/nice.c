@@ -0,0 +1,40 @@
+// Run a command with a different nice value.
+// Usage: nice [-n adjustment] command [args...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+int
+main(int argc, char *argv[])
+{
+	int inc = 10, i = 1;
+	char *path, buf[256];
+
+	if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+		inc = atoi(argv[2]);
+		i = 3;
+	}
+	if (i >= argc) {
+		fprintf(stderr, "usage: nice [-n adjustment] command [args...]\n");
+		exit(1);
+	}
+	errno = 0;
+	if (nice(inc) == -1 && errno != 0)
+		perror("nice");
+	execv(argv[i], argv + i);
+	// Look for it along $PATH, as the shell does.
+	if (strchr(argv[i], '/') == NULL && (path = getenv("PATH")) != NULL &&
+			(path = strdup(path)) != NULL) {
+		for (char *dir = strtok(path, ":"); dir; dir = strtok(NULL, ":")) {
+			if (strlen(dir) + strlen(argv[i]) + 2 > sizeof(buf))
+				continue;
+			sprintf(buf, "%s/%s", dir, argv[i]);
+			execv(buf, argv + i);
+		}
+	}
+	fprintf(stderr, "nice: cannot run %s\n", argv[i]);
+	exit(1);
+}
@@ -0,0 +1,79 @@
+// Several processes each make their own set of files, then
+// open and close all of them over and over, so that the inode
+// cache sees many distinct inodes at once.
+// Usage: openbench [nproc [nfiles]]
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <ext.h>
+#include <sys/wait.h>
+
+#define ROUNDS 20
+
+// Outside main so fork() cannot clobber them.
+static int nproc = 4, nfiles = 32;
+
+static void
+run(int id)
+{
+	char name[32];
+	int fd, i, r;
+
+	for (i = 0; i < nfiles; i++) {
+		sprintf(name, "ob%d.%d", id, i);
+		if ((fd = open(name, O_CREATE | O_RDWR)) < 0) {
+			fprintf(stderr, "openbench: cannot create %s\n", name);
+			exit(1);
+		}
+		close(fd);
+	}
+	for (r = 0; r < ROUNDS; r++) {
+		for (i = 0; i < nfiles; i++) {
+			sprintf(name, "ob%d.%d", id, i);
+			if ((fd = open(name, O_RDONLY)) < 0) {
+				fprintf(stderr, "openbench: cannot open %s\n", name);
+				exit(1);
+			}
+			close(fd);
+		}
+	}
+	for (i = 0; i < nfiles; i++) {
+		sprintf(name, "ob%d.%d", id, i);
+		unlink(name);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	int p, t0;
+
+	if (argc > 1)
+		nproc = atoi(argv[1]);
+	if (argc > 2)
+		nfiles = atoi(argv[2]);
+	if (nproc < 1 || nfiles < 1) {
+		fprintf(stderr, "usage: openbench [nproc [nfiles]]\n");
+		exit(1);
+	}
+
+	t0 = uptime();
+	for (p = 0; p < nproc; p++) {
+		int pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "openbench: fork failed\n");
+			exit(1);
+		}
+		if (pid == 0) {
+			run(p);
+			exit(0);
+		}
+	}
+	for (p = 0; p < nproc; p++)
+		wait(NULL);
+	printf("%d processes opened %d files %d times each in %d ticks\n", nproc,
+				 nfiles, ROUNDS, uptime() - t0);
+	return 0;
+}
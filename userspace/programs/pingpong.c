@@ -0,0 +1,105 @@
+// Two processes bounce a byte back and forth over a pair of
+// pipes while nidle others sleep on pipes of their own, so
+// every round trip is two sleeps and two wakeups among that
+// many sleepers. Reports the round trips per tick and how
+// many sleepers the wakeups had to look at.
+// Usage: pingpong [nidle [nrounds]]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <ext.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+// Outside main so fork() cannot clobber them.
+static int nidle = 16, nrounds = 2000, n;
+static struct sched_stats before, after;
+static uint64_t wakeups, woken, scanned;
+
+static void
+bounce(int in, int out, int first)
+{
+	char c = 0;
+
+	for (n = 0; n < nrounds; n++) {
+		if ((!first || n > 0) && read(in, &c, 1) != 1)
+			break;
+		if (write(out, &c, 1) != 1)
+			break;
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	int idle[2], ping[2], pong[2], pid, t0, ticks;
+
+	if (argc > 1)
+		nidle = atoi(argv[1]);
+	if (argc > 2)
+		nrounds = atoi(argv[2]);
+	if (nidle < 0 || nrounds < 1) {
+		fprintf(stderr, "usage: pingpong [nidle [nrounds]]\n");
+		exit(1);
+	}
+
+	// The idle processes all block reading one pipe, and
+	// exit once it is closed.
+	if (pipe(idle) < 0 || pipe(ping) < 0 || pipe(pong) < 0) {
+		fprintf(stderr, "pingpong: pipe failed\n");
+		exit(1);
+	}
+	for (n = 0; n < nidle; n++) {
+		pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "pingpong: fork failed\n");
+			exit(1);
+		}
+		if (pid == 0) {
+			char c;
+			close(idle[1]);
+			read(idle[0], &c, 1);
+			exit(0);
+		}
+	}
+	close(idle[0]);
+	sleep(1);
+
+	if (ioctl(0, SCHEDIOCGSTATS, &before) < 0) {
+		perror("ioctl");
+		exit(1);
+	}
+	t0 = uptime();
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "pingpong: fork failed\n");
+		exit(1);
+	}
+	if (pid == 0) {
+		bounce(ping[0], pong[1], 0);
+		exit(0);
+	}
+	bounce(pong[0], ping[1], 1);
+	wait(NULL);
+	ticks = uptime() - t0;
+	if (ioctl(0, SCHEDIOCGSTATS, &after) < 0) {
+		perror("ioctl");
+		exit(1);
+	}
+
+	close(idle[1]);
+	for (n = 0; n < nidle; n++)
+		wait(NULL);
+
+	for (uint32_t c = 0; c < after.ncpu; c++) {
+		wakeups += after.cpu[c].wakeups - before.cpu[c].wakeups;
+		woken += after.cpu[c].woken - before.cpu[c].woken;
+		scanned += after.cpu[c].wait_scanned - before.cpu[c].wait_scanned;
+	}
+	printf("%d round trips beside %d sleepers in %d ticks\n", nrounds, nidle,
+				 ticks);
+	printf("%lu wakeups woke %lu processes, looking at %lu sleepers\n", wakeups,
+				 woken, scanned);
+	return 0;
+}
@@ -0,0 +1,29 @@
+// List the processes with their nice values and the CPU time
+// each has had, in millions of cycles.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+
+static const char *states[] = { "unused", "embryo", "sleep",
+																"runble", "run",		"zombie" };
+static struct proc_stats st[NPROCSTATS];
+
+int
+main(void)
+{
+	if (ioctl(0, PROCIOCGSTATS, st) < 0) {
+		perror("ioctl");
+		exit(1);
+	}
+	printf("  PID  PPID CPU  NI STATE        MCYC SWITCHES NAME\n");
+	for (int i = 0; i < NPROCSTATS && st[i].pid != 0; i++) {
+		const char *state = "???";
+		if (st[i].state >= 0 && st[i].state < 6)
+			state = states[st[i].state];
+		printf("%5d %5d %3d %3d %-6s %10lu %8lu %s\n", st[i].pid, st[i].ppid,
+					 st[i].cpu, st[i].nice, state, st[i].runtime / 1000000,
+					 st[i].switches, st[i].name);
+	}
+	return 0;
+}
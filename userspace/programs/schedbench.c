@@ -0,0 +1,87 @@
+// Keeps nspin processes busy on the CPUs while the parent forks
+// and reaps nforks short-lived children, so every child has to
+// find a CPU among the spinners, and the parent runs again only
+// once its child exits. Reports how long that took and what
+// each CPU's scheduler did meanwhile.
+// Usage: schedbench [nspin [nforks]]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <ext.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#define MAXSPIN 64
+
+// Outside main so fork() cannot clobber them.
+static int nspin = 4, nforks = 500, n;
+static int spinners[MAXSPIN];
+static struct sched_stats before, after;
+
+int
+main(int argc, char *argv[])
+{
+	int t0, ticks;
+
+	if (argc > 1)
+		nspin = atoi(argv[1]);
+	if (argc > 2)
+		nforks = atoi(argv[2]);
+	if (nspin < 0 || nspin > MAXSPIN || nforks < 1) {
+		fprintf(stderr, "usage: schedbench [nspin [nforks]]\n");
+		exit(1);
+	}
+
+	for (n = 0; n < nspin; n++) {
+		spinners[n] = fork();
+		if (spinners[n] < 0) {
+			fprintf(stderr, "schedbench: fork failed\n");
+			exit(1);
+		}
+		if (spinners[n] == 0) {
+			for (;;)
+				;
+		}
+	}
+	if (ioctl(0, SCHEDIOCGSTATS, &before) < 0) {
+		perror("ioctl");
+		exit(1);
+	}
+
+	t0 = uptime();
+	for (n = 0; n < nforks; n++) {
+		int pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "schedbench: fork failed\n");
+			exit(1);
+		}
+		if (pid == 0)
+			exit(0);
+		wait(NULL);
+	}
+	ticks = uptime() - t0;
+
+	if (ioctl(0, SCHEDIOCGSTATS, &after) < 0) {
+		perror("ioctl");
+		exit(1);
+	}
+	for (n = 0; n < nspin; n++)
+		kill(spinners[n], SIGKILL);
+	for (n = 0; n < nspin; n++)
+		wait(NULL);
+
+	printf("%d forks beside %d spinning processes in %d ticks\n", nforks,
+				 nspin, ticks);
+	for (uint32_t c = 0; c < after.ncpu; c++) {
+		struct sched_cpu_stats *b = &before.cpu[c], *a = &after.cpu[c];
+		printf("cpu %u: %lu switches, %lu preempted, %lu stolen, %lu idle, "
+					 "%lu of %lu locks contended, %lu queued\n",
+					 c, a->switches - b->switches, a->preempts - b->preempts,
+					 a->steals - b->steals, a->idle - b->idle,
+					 a->contended - b->contended,
+					 a->acquires - b->acquires, a->nrunnable);
+	}
+	return 0;
+}
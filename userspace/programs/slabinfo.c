@@ -0,0 +1,24 @@
+// Print the usage of the kernel's slab caches.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+
+int
+main(void)
+{
+	struct slab_stats st[NSLABSTATS];
+
+	if (ioctl(0, SLABIOCGSTATS, st) < 0) {
+		perror("ioctl");
+		exit(1);
+	}
+	printf("%-14s   size  pages  objects    inuse     allocs      frees\n",
+				 "cache");
+	for (int i = 0; i < NSLABSTATS && st[i].name[0]; i++) {
+		printf("%-14s %6u %6u %8u %8u %10lu %10lu\n", st[i].name, st[i].size,
+					 st[i].pages, st[i].objects, st[i].inuse, st[i].allocs,
+					 st[i].frees);
+	}
+	return 0;
+}
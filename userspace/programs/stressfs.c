@@ -1,7 +1,11 @@
-// Demonstrate that moving the "acquire" in iderw after the loop that
-// appends to the idequeue results in a race.
+// Several processes write and read back files at the same time,
+// then the first one reports how long it took and how often
+// the buffer cache's hash bucket locks were contended.
+// Usage: stressfs [nproc]
 
-// For this to work, you should also add a spin within iderw's
+// It started life as a demonstration that moving the "acquire" in
+// iderw after the loop that appends to the idequeue results in a race.
+// For that, you should also add a spin within iderw's
 // idequeue traversal loop.  Adding the following demonstrated a panic
 // after about 5 runs of stressfs in QEMU on a 2.1GHz CPU:
 //    for (i = 0; i < 40000; i++)
@@ -12,20 +16,40 @@
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <ext.h>
+#include <sys/ioctl.h>
 #include <sys/wait.h>
 #include <stddef.h>
 
+#define NBLOCK 100
+
+// Outside main so fork() cannot clobber them.
+static int nproc = 4, t0;
+
 int
-main(void)
+main(int argc, char *argv[])
 {
-	int fd, i;
+	int fd, i, n;
 	char path[] = "stressfs0";
 	char data[512];
+	struct bio_stats before, after;
+
+	if (argc > 1)
+		nproc = atoi(argv[1]);
+	if (nproc < 1 || nproc > 9) {
+		fprintf(stderr, "usage: stressfs [1-9]\n");
+		exit(1);
+	}
 
 	fprintf(stdout, "stressfs starting\n");
 	memset(data, 'a', sizeof(data));
+	if (ioctl(0, BIOIOCGSTATS, &before) < 0) {
+		perror("ioctl");
+		exit(1);
+	}
+	t0 = uptime();
 
-	for (i = 0; i < 4; i++)
+	for (i = 0; i < nproc - 1; i++)
 		if (fork() > 0)
 			break;
 
@@ -33,7 +57,7 @@ main(void)
 
 	path[8] += i;
 	fd = open(path, O_CREATE | O_RDWR);
-	for (i = 0; i < 20; i++)
+	for (n = 0; n < NBLOCK; n++)
 		//    fprintf(fd, "%d\n", i);
 		write(fd, data, sizeof(data));
 	close(fd);
@@ -41,11 +65,17 @@ main(void)
 	fprintf(stdout, "read\n");
 
 	fd = open(path, O_RDONLY);
-	for (i = 0; i < 20; i++)
+	for (n = 0; n < NBLOCK; n++)
 		read(fd, data, sizeof(data));
 	close(fd);
+	unlink(path);
 
 	wait(NULL);
 
+	if (i == 0 && ioctl(0, BIOIOCGSTATS, &after) == 0) {
+		printf("%d processes: %d ticks, %lu of %lu bucket locks contended\n",
+					 nproc, uptime() - t0, after.contended - before.contended,
+					 after.acquires - before.acquires);
+	}
 	return 0;
 }
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <sys/wait.h>
+#include <time.h>
 
 int
 main(int argc, char **argv)
@@ -12,7 +13,10 @@ main(int argc, char **argv)
 		fprintf(stderr, "usage: %s [program] [program_args]\n", argv[0]);
 		exit(1);
 	}
-	int before = uptime();
+	struct timespec t0, t1;
+	uint64_t us;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
 	char *path = malloc(FILENAME_MAX);
 	if (path == NULL) {
 		perror("malloc");
@@ -22,6 +26,8 @@ main(int argc, char **argv)
 	if (fork() == 0)
 		exec(path, argv + 1);
 	wait(NULL);
-	printf("wall time %dms\n", (uptime() - before));
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	us = (t1.tv_sec - t0.tv_sec) * 1000000 + t1.tv_nsec / 1000 - t0.tv_nsec / 1000;
+	printf("wall time %lu.%03lums\n", us / 1000, us % 1000);
 	return 0;
 }
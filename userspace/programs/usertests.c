@@ -1,6 +1,7 @@
 #include <stdint.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <kernel/include/param.h>
 #include <kernel/include/fs.h>
 #include <kernel/include/syscall.h>
@@ -13,6 +14,10 @@
 #include <string.h>
 #include <signal.h>
 #include <stddef.h>
+#include <ext.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
 
 #pragma GCC diagnostic ignored "-Wunknown-pragmas"
 #pragma clang diagnostic ignored "-Wunknown-warning-option"
@@ -257,6 +262,117 @@ writetest1(void)
 	fprintf(stdout, "big files ok\n");
 }
 
+// fsync() and O_SYNC writes wait for the log to commit;
+// the data must still read back the same afterwards.
+void
+fsynctest(void)
+{
+	int fd, fds[2];
+	char buf[64];
+
+	fprintf(stdout, "fsync test\n");
+	fd = open("fsyncfile", O_CREATE | O_RDWR | O_SYNC);
+	if (fd < 0) {
+		fprintf(stdout, "fsync test: create failed\n");
+		exit(0);
+	}
+	if (write(fd, "synchronous", 11) != 11 || fsync(fd) != 0) {
+		fprintf(stdout, "fsync test: write or fsync failed\n");
+		exit(0);
+	}
+	close(fd);
+	fd = open("fsyncfile", O_RDONLY);
+	if (fsync(fd) != 0 || read(fd, buf, sizeof(buf)) != 11 ||
+			memcmp(buf, "synchronous", 11) != 0) {
+		fprintf(stdout, "fsync test: read back failed\n");
+		exit(0);
+	}
+	close(fd);
+	unlink("fsyncfile");
+
+	if (pipe(fds) != 0) {
+		fprintf(stdout, "fsync test: pipe failed\n");
+		exit(0);
+	}
+	if (fsync(fds[0]) != -1) {
+		fprintf(stdout, "fsync test: fsync of a pipe succeeded\n");
+		exit(0);
+	}
+	close(fds[0]);
+	close(fds[1]);
+	fprintf(stdout, "fsync test ok\n");
+}
+
+// Names that were looked up while missing, then created, then
+// removed again, must not be answered from a stale name cache.
+void
+namecachetest(void)
+{
+	int fd;
+
+	fprintf(stdout, "name cache test\n");
+	unlink("ncfile");
+	if (open("ncfile", O_RDONLY) >= 0) {
+		fprintf(stdout, "name cache test: ncfile exists\n");
+		exit(0);
+	}
+	if ((fd = open("ncfile", O_CREATE | O_RDWR)) < 0) {
+		fprintf(stdout, "name cache test: create failed\n");
+		exit(0);
+	}
+	close(fd);
+	if ((fd = open("ncfile", O_RDONLY)) < 0) {
+		fprintf(stdout, "name cache test: stale negative entry\n");
+		exit(0);
+	}
+	close(fd);
+	if (unlink("ncfile") < 0 || open("ncfile", O_RDONLY) >= 0) {
+		fprintf(stdout, "name cache test: stale positive entry\n");
+		exit(0);
+	}
+	fprintf(stdout, "name cache test ok\n");
+}
+
+// More descriptors than the initial fd table holds; freed ones
+// are handed out again lowest first, and survive fork.
+void
+manyfdtest(void)
+{
+	int fd, i, pid;
+
+	fprintf(stdout, "many fds test\n");
+	for (i = 3; i < 100; i++) {
+		if ((fd = dup(0)) != i) {
+			fprintf(stdout, "many fds test: dup gave %d, not %d\n", fd, i);
+			exit(0);
+		}
+	}
+	close(40);
+	close(7);
+	if (dup(0) != 7 || dup(0) != 40) {
+		fprintf(stdout, "many fds test: not lowest free fd\n");
+		exit(0);
+	}
+	pid = fork();
+	if (pid == 0) {
+		if (write(99, "", 0) < 0) {
+			fprintf(stdout, "many fds test: fd 99 lost in fork\n");
+			exit(1);
+		}
+		exit(0);
+	}
+	wait(&i);
+	if (i != 0)
+		exit(0);
+	for (i = 3; i < 100; i++)
+		close(i);
+	if (write(99, "", 0) >= 0) {
+		fprintf(stdout, "many fds test: fd 99 still open\n");
+		exit(0);
+	}
+	fprintf(stdout, "many fds test ok\n");
+}
+
 void
 createtest(void)
 {
@@ -1461,6 +1577,183 @@ forktest(void)
 	fprintf(stdout, "fork test OK\n");
 }
 
+// nice values are per process, inherited by fork, and
+// kept in range; only the PRIO_PROCESS kind is supported.
+void
+nicetest(void)
+{
+	int pid;
+
+	fprintf(stdout, "nice test\n");
+	if (getpriority(PRIO_PROCESS, 0) != 0 || nice(5) != 5 ||
+			getpriority(PRIO_PROCESS, getpid()) != 5) {
+		fprintf(stdout, "nice test: nice(5) did not stick\n");
+		exit(0);
+	}
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stdout, "nice test: fork failed\n");
+		exit(0);
+	}
+	if (pid == 0) {
+		if (getpriority(PRIO_PROCESS, 0) != 5)
+			fprintf(stdout, "nice test: child did not inherit nice\n");
+		exit(0);
+	}
+	wait(NULL);
+	if (setpriority(PRIO_PROCESS, 0, 100) != 0 ||
+			getpriority(PRIO_PROCESS, 0) != NICE_MAX) {
+		fprintf(stdout, "nice test: nice not clamped\n");
+		exit(0);
+	}
+	if (setpriority(PRIO_USER, 0, 0) != -1) {
+		fprintf(stdout, "nice test: PRIO_USER accepted\n");
+		exit(0);
+	}
+	setpriority(PRIO_PROCESS, 0, 0);
+	fprintf(stdout, "nice test OK\n");
+}
+
+// Sleepers wake in the order of their deadlines, nanosleep()
+// sleeps at least as long as it was asked to, and the clock
+// keeps time with both.
+void
+sleeptest(void)
+{
+	static const int naps[] = { 30, 10, 20 };
+	struct timespec ts = { 0, 20 * 1000000 }, c0, c1;
+	int fds[2], pid, t0, i;
+	long ms;
+	char order[3];
+
+	fprintf(stdout, "sleep test\n");
+	if (pipe(fds) != 0) {
+		fprintf(stdout, "sleep test: pipe failed\n");
+		exit(0);
+	}
+	for (i = 0; i < 3; i++) {
+		pid = fork();
+		if (pid < 0) {
+			fprintf(stdout, "sleep test: fork failed\n");
+			exit(0);
+		}
+		if (pid == 0) {
+			char c = '0' + i;
+			sleep(naps[i] * 10);
+			write(fds[1], &c, 1);
+			exit(0);
+		}
+	}
+	close(fds[1]);
+	for (i = 0; i < 3; i++) {
+		if (read(fds[0], &order[i], 1) != 1) {
+			fprintf(stdout, "sleep test: read failed\n");
+			exit(0);
+		}
+	}
+	close(fds[0]);
+	for (i = 0; i < 3; i++)
+		wait(NULL);
+	if (order[0] != '1' || order[1] != '2' || order[2] != '0') {
+		fprintf(stdout, "sleep test: woke out of order\n");
+		exit(0);
+	}
+
+	t0 = uptime();
+	if (nanosleep(&ts, NULL) != 0 || uptime() - t0 < 20 * HZ / 1000) {
+		fprintf(stdout, "sleep test: nanosleep too short\n");
+		exit(0);
+	}
+	ts.tv_nsec = 1000000000;
+	if (nanosleep(&ts, NULL) != -1) {
+		fprintf(stdout, "sleep test: bad nanosleep accepted\n");
+		exit(0);
+	}
+
+	// The clock agrees with the tick count, and goes forward.
+	if (clock_gettime(CLOCK_MONOTONIC, &c0) != 0) {
+		fprintf(stdout, "sleep test: clock_gettime failed\n");
+		exit(0);
+	}
+	t0 = uptime();
+	sleep(HZ / 10);
+	clock_gettime(CLOCK_MONOTONIC, &c1);
+	ms = (c1.tv_sec - c0.tv_sec) * 1000 + c1.tv_nsec / 1000000 -
+			 c0.tv_nsec / 1000000;
+	if (ms < 90 || ms > (uptime() - t0) * 1000 / HZ + 10) {
+		fprintf(stdout, "sleep test: clock says %ld ms for 100\n", ms);
+		exit(0);
+	}
+	fprintf(stdout, "sleep test OK\n");
+}
+
+// fork shares pages copy-on-write: check that writes on
+// either side stay private, then time fork against process size.
+void
+cowforktest(void)
+{
+	static const int sizes[] = { 0, 1, 4, 16 }; // MiB
+	char *a;
+	int pid, t0, i, n;
+
+	fprintf(stdout, "cow fork test\n");
+	a = sbrk(4096);
+	if (a == (char *)-1) {
+		fprintf(stdout, "cow fork test: sbrk failed\n");
+		exit(0);
+	}
+	a[0] = 'p';
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stdout, "cow fork test: fork failed\n");
+		exit(0);
+	}
+	if (pid == 0) {
+		if (a[0] != 'p') {
+			fprintf(stdout, "cow fork test: child sees %c\n", a[0]);
+			exit(0);
+		}
+		a[0] = 'c';
+		if (a[0] != 'c') {
+			fprintf(stdout, "cow fork test: child write lost\n");
+			exit(0);
+		}
+		exit(0);
+	}
+	wait(NULL);
+	if (a[0] != 'p') {
+		fprintf(stdout, "cow fork test: child write leaked into parent\n");
+		exit(0);
+	}
+	sbrk(-4096);
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		int len = sizes[i] * 1024 * 1024;
+		a = sbrk(len);
+		if (a == (char *)-1) {
+			fprintf(stdout, "cow fork test: sbrk %d MiB failed\n", sizes[i]);
+			exit(0);
+		}
+		for (n = 0; n < len; n += 4096)
+			a[n] = 1;
+		t0 = uptime();
+		for (n = 0; n < 100; n++) {
+			pid = fork();
+			if (pid < 0) {
+				fprintf(stdout, "cow fork test: fork failed\n");
+				exit(0);
+			}
+			if (pid == 0)
+				exit(0);
+			wait(NULL);
+		}
+		fprintf(stdout, "cow fork test: 100 forks of +%d MiB took %d ticks\n",
+						sizes[i], uptime() - t0);
+		sbrk(-len);
+	}
+	fprintf(stdout, "cow fork test OK\n");
+}
+
 void
 sbrktest(void)
 {
@@ -1599,6 +1892,180 @@ sbrktest(void)
 	fprintf(stdout, "sbrk test OK\n");
 }
 
+// Free physical memory, in pages.
+static uint64_t
+freepages(void)
+{
+	struct mem_stats st;
+	uint64_t n;
+
+	if (ioctl(0, MEMIOCGSTATS, &st) < 0)
+		return 0;
+	n = st.cached + st.zeroed;
+	for (int i = 0; i < 11; i++)
+		n += st.nfree[i] << i;
+	return n;
+}
+
+// sbrk only reserves address space: reserve a large region,
+// touch a few pages, make sure they work, and check that only
+// those pages (or the large pages around them) take memory.
+void
+sbrklazytest(void)
+{
+	int len = 64 * 1024 * 1024;
+	char *a, *oldbrk;
+	int pid, n;
+	uint64_t before, after, used;
+
+	fprintf(stdout, "sbrk lazy test\n");
+	before = freepages();
+	oldbrk = sbrk(0);
+	a = sbrk(len);
+	if (a == (char *)-1) {
+		fprintf(stdout, "sbrk lazy test: could not reserve %d MiB\n",
+						len / (1024 * 1024));
+		exit(0);
+	}
+	for (n = 0; n < len; n += len / 8)
+		a[n] = 'x';
+	a[len - 1] = 'y';
+	after = freepages();
+	used = before > after ? before - after : 0;
+	fprintf(stdout, "sbrk lazy test: %d MiB reserved, %lu KiB used\n",
+					len / (1024 * 1024), used * 4);
+	if (used * 4096 > (uint64_t)len / 2) {
+		fprintf(stdout, "sbrk lazy test: touching 9 pages used too much\n");
+		exit(0);
+	}
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stdout, "sbrk lazy test: fork failed\n");
+		exit(0);
+	}
+	if (pid == 0) {
+		if (a[len / 8] != 'x' || a[len - 1] != 'y' || a[len / 16] != 0) {
+			fprintf(stdout, "sbrk lazy test: child sees bad data\n");
+			exit(0);
+		}
+		a[len / 16] = 'z';
+		exit(0);
+	}
+	wait(NULL);
+	if (a[len / 16] != 0) {
+		fprintf(stdout, "sbrk lazy test: child write leaked into parent\n");
+		exit(0);
+	}
+	sbrk(-((char *)sbrk(0) - oldbrk));
+	fprintf(stdout, "sbrk lazy test OK\n");
+}
+
+// The heap is backed by large pages where it can be: check that
+// they are shared copy-on-write by fork, and that shrinking the
+// heap to the middle of one keeps the part below intact.
+void
+hugepagetest(void)
+{
+	int len = 8 * 1024 * 1024;
+	char *a, *oldbrk;
+	int pid, n;
+
+	fprintf(stdout, "huge page test\n");
+	oldbrk = sbrk(0);
+	a = sbrk(len);
+	if (a == (char *)-1) {
+		fprintf(stdout, "huge page test: sbrk failed\n");
+		exit(0);
+	}
+	for (n = 0; n < len; n += 4096)
+		a[n] = n / 4096;
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stdout, "huge page test: fork failed\n");
+		exit(0);
+	}
+	if (pid == 0) {
+		for (n = 0; n < len; n += 4096) {
+			if (a[n] != (char)(n / 4096)) {
+				fprintf(stdout, "huge page test: child sees bad data\n");
+				exit(0);
+			}
+			a[n] = 0;
+		}
+		exit(0);
+	}
+	wait(NULL);
+	for (n = 0; n < len; n += 4096) {
+		if (a[n] != (char)(n / 4096)) {
+			fprintf(stdout, "huge page test: child write leaked into parent\n");
+			exit(0);
+		}
+	}
+	sbrk(-(len / 2 + 4096));
+	for (n = 0; n < len / 2 - 4096; n += 4096) {
+		if (a[n] != (char)(n / 4096)) {
+			fprintf(stdout, "huge page test: shrinking lost data\n");
+			exit(0);
+		}
+	}
+	sbrk(-((char *)sbrk(0) - oldbrk));
+	fprintf(stdout, "huge page test OK\n");
+}
+
+// munmap gives back both the memory and the slot, so mapping
+// and unmapping over and over never runs out of either, and
+// sbrk keeps clear of what is mapped.
+void
+mmaptest(void)
+{
+	int len = 16 * 4096, fd, i, n;
+	char *a;
+
+	fprintf(stdout, "mmap test\n");
+	fd = open("mmapfile", O_CREATE | O_RDWR);
+	if (fd < 0) {
+		fprintf(stdout, "mmap test: open failed\n");
+		exit(0);
+	}
+	for (i = 0; i < 4 * NMMAP; i++) {
+		a = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (a == MMAP_FAILED) {
+			fprintf(stdout, "mmap test: mmap %d failed\n", i);
+			exit(0);
+		}
+		for (n = 0; n < len; n += 4096) {
+			if (a[n] != 0) {
+				fprintf(stdout, "mmap test: memory not zeroed\n");
+				exit(0);
+			}
+			a[n] = 1;
+		}
+		if (munmap(a, len) != 0) {
+			fprintf(stdout, "mmap test: munmap failed\n");
+			exit(0);
+		}
+		if (munmap(a, len) != -1) {
+			fprintf(stdout, "mmap test: munmap twice succeeded\n");
+			exit(0);
+		}
+	}
+
+	// The heap can't grow over a mapping.
+	a = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (a == MMAP_FAILED) {
+		fprintf(stdout, "mmap test: mmap failed\n");
+		exit(0);
+	}
+	if (sbrk(a + len - (char *)sbrk(0)) != (char *)-1) {
+		fprintf(stdout, "mmap test: sbrk grew over a mapping\n");
+		exit(0);
+	}
+	munmap(a, len);
+	close(fd);
+	unlink("mmapfile");
+	fprintf(stdout, "mmap test OK\n");
+}
+
 void
 validateint(__attribute__((unused)) int *p)
 {
@@ -1661,6 +2128,38 @@ bsstest(void)
 	fprintf(stdout, "bss test ok\n");
 }
 
+// exec loads pages of the program on first touch: check that
+// initialized data spanning several pages arrives intact, both
+// when the program reads it and when the kernel does.
+char paged[4 * 4096] = { [0] = 'a', [4096] = 'b', [2 * 4096 + 17] = 'c',
+												 [4 * 4096 - 1] = 'd' };
+
+void
+demandloadtest(void)
+{
+	int fds[2];
+	char c;
+
+	fprintf(stdout, "demand load test\n");
+	if (pipe(fds) != 0) {
+		fprintf(stdout, "demand load test: pipe failed\n");
+		exit(0);
+	}
+	if (write(fds[1], &paged[2 * 4096 + 17], 1) != 1 ||
+			read(fds[0], &c, 1) != 1 || c != 'c') {
+		fprintf(stdout, "demand load test: kernel read bad data\n");
+		exit(0);
+	}
+	close(fds[0]);
+	close(fds[1]);
+	if (paged[0] != 'a' || paged[4096] != 'b' || paged[4 * 4096 - 1] != 'd' ||
+			paged[4096 + 1] != 0) {
+		fprintf(stdout, "demand load test failed\n");
+		exit(0);
+	}
+	fprintf(stdout, "demand load test ok\n");
+}
+
 // does exec return an error if the arguments
 // are larger than a page? or does it write
 // below the stack and wreck the instructions/data?
@@ -1817,7 +2316,11 @@ main(int argc, char *argv[])
 		}
 		if (strcmp(argv[1], "memtest") == 0) {
 			largemem();
+			cowforktest();
 			sbrktest();
+			sbrklazytest();
+			hugepagetest();
+			mmaptest();
 			mem();
 			return 0;
 		}
@@ -1834,12 +2337,19 @@ main(int argc, char *argv[])
 	bigwrite();
 	bigargtest();
 	bsstest();
+	demandloadtest();
 	sbrktest();
+	sbrklazytest();
+	hugepagetest();
+	mmaptest();
 	validatetest();
 
 	opentest();
 	writetest();
 	writetest1();
+	fsynctest();
+	namecachetest();
+	manyfdtest();
 	createtest();
 
 	openiputtest();
@@ -1860,6 +2370,9 @@ main(int argc, char *argv[])
 	dirfile();
 	iref();
 	forktest();
+	nicetest();
+	sleeptest();
+	cowforktest();
 	bigdir(); // slow
 
 #ifndef X86_64
@@ -17,7 +17,7 @@ FILE *stdin;
 FILE *stdout;
 FILE *stderr;
 
-static FILE *open_files[NFILE];
+static FILE *open_files[FOPEN_MAX];
 static size_t open_files_index = 0;
 
 static uint32_t global_idx = 0;
@@ -147,11 +147,11 @@ fopen(const char *restrict pathname, const char *restrict mode)
 	fp->write_buffer_size = WRITE_BUFFER_SIZE;
 	fp->write_buffer_index = 0;
 	fp->stdio_flush = true;
-	if (open_files_index < NFILE) {
+	if (open_files_index < FOPEN_MAX) {
 		fp->static_table_index = open_files_index;
 		open_files[open_files_index++] = fp;
 	} else {
-		for (size_t i = 0; i < NFILE; i++) {
+		for (size_t i = 0; i < FOPEN_MAX; i++) {
 			if (open_files[i] == NULL) {
 				fp->static_table_index = i;
 				open_files[i] = fp;
@@ -185,11 +185,11 @@ fdopen(int fd, const char *restrict mode)
 	fp->write_buffer_size = WRITE_BUFFER_SIZE;
 	fp->write_buffer_index = 0;
 	fp->stdio_flush = true;
-	if (open_files_index < NFILE) {
+	if (open_files_index < FOPEN_MAX) {
 		fp->static_table_index = open_files_index;
 		open_files[open_files_index++] = fp;
 	} else {
-		for (size_t i = 0; i < NFILE; i++) {
+		for (size_t i = 0; i < FOPEN_MAX; i++) {
 			if (open_files[i] == NULL) {
 				fp->static_table_index = i;
 				open_files[i] = fp;
@@ -10,6 +10,7 @@
 #include <kernel/include/x86.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/resource.h>
 #include <stddef.h>
 #include <time.h>
 
@@ -332,6 +333,29 @@ getcwd(char *buf, size_t n)
 		return buf;
 }
 
+extern int
+__getpriority(int which, int who);
+int
+getpriority(int which, int who)
+{
+	int ret = __getpriority(which, who);
+	if (ret < 0)
+		return -1;
+	return 20 - ret;
+}
+
+int
+nice(int inc)
+{
+	// getpriority() returns -1 both on error and for nice -1.
+	int ret = __getpriority(PRIO_PROCESS, 0);
+	if (ret < 0)
+		return -1;
+	if (setpriority(PRIO_PROCESS, 0, 20 - ret + inc) < 0)
+		return -1;
+	return getpriority(PRIO_PROCESS, 0);
+}
+
 int
 fcntl(int fd, int cmd, ...)
 {